@@ -11,8 +11,9 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
+/* Read-back command: latch count and status of one channel. */
+#define PIT_READ_BACK(CHANNEL)    (0xc0 | (2 << (CHANNEL)))
+#define PIT_STATUS_OUTPUT         0x80                /* OUT pin is high. */
 
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
@@ -81,3 +82,47 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts the given CHANNEL counting down COUNT PIT cycles in
+   mode 0, "interrupt on terminal count": the channel's output
+   goes high, raising a single interrupt on channel 0, when the
+   count reaches zero, and stays high until the channel is
+   reprogrammed.  A COUNT of 0 is treated as 65536. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the number of PIT cycles left in the current count of
+   CHANNEL.  If EXPIRED is non-null, sets *EXPIRED to whether
+   the channel's output is high, which in mode 0 means that the
+   count has already reached zero (after which the returned value
+   is meaningless). */
+uint16_t
+pit_read_count (int channel, bool *expired)
+{
+  uint8_t status, low, high;
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, PIT_READ_BACK (channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  low = inb (PIT_PORT_COUNTER (channel));
+  high = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  if (expired != NULL)
+    *expired = (status & PIT_STATUS_OUTPUT) != 0;
+  return low | (high << 8);
+}
@@ -6,6 +6,7 @@
 #include <list.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/io.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -18,12 +19,62 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* list of sleeping threads*/
-static struct list sleeping_list;
+/* Sleeping threads are kept in a hierarchical timing wheel, so
+   that registering a sleeper and expiring the sleepers of a tick
+   both take O(1) amortized time with interrupts off.
+
+   The near wheel has one slot for each of the next NEAR_SLOTS
+   ticks.  Each outer wheel has OUTER_SLOTS slots, each covering
+   NEAR_SLOTS * OUTER_SLOTS^(level - 1) ticks.  Whenever the near
+   wheel wraps around, the next slot of the first outer wheel is
+   cascaded, that is, its threads are redistributed into finer
+   slots; that wheel in turn cascades the next one when it wraps,
+   and so on.  Deadlines beyond the reach of the last wheel are
+   parked in its farthest slot and cascaded again as needed. */
+#define NEAR_BITS 8
+#define OUTER_BITS 6
+#define NEAR_SLOTS (1 << NEAR_BITS)
+#define OUTER_SLOTS (1 << OUTER_BITS)
+#define OUTER_LEVELS 4
+#define NEAR_MASK (NEAR_SLOTS - 1)
+#define OUTER_MASK (OUTER_SLOTS - 1)
+
+static struct list near_wheel[NEAR_SLOTS];
+static struct list outer_wheel[OUTER_LEVELS][OUTER_SLOTS];
+
+/* Next tick whose near wheel slot has not yet been expired. */
+static int64_t wheel_tick;
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Tickless idle.
+
+   While only the idle thread can run, there is nothing to do on
+   a tick unless a sleeper is due or an outer wheel must cascade.
+   timer_idle_enter() then reprograms the PIT to raise a single
+   interrupt at the first tick that has work, and the first
+   external interrupt afterward (the one-shot itself or any other
+   device) calls timer_idle_exit() to account for the ticks that
+   elapsed and restore the periodic tick.  The 16-bit PIT counter
+   limits a one-shot to TICKLESS_MAX ticks. */
+#define PIT_COUNT_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define TICKLESS_MAX (UINT16_MAX / PIT_COUNT_PER_TICK)
+
+/* If true, idle() stops the periodic tick while nothing is due.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+static bool in_oneshot;                 /* PIT is in one-shot mode. */
+static int oneshot_ticks;               /* Ticks the one-shot covers. */
+static int oneshot_remainder;           /* PIT counts short of a tick
+                                           left by early wakeups. */
+
+/* Longest time spent in timer_interrupt(), in TSC cycles, since
+   the last timer_reset_interrupt_stats().  The handler runs with
+   interrupts off, so this bounds the tick's interrupt latency. */
+static uint64_t max_interrupt_cycles;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -33,16 +84,27 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
-static bool timer_compare (const struct list_elem* a, const struct list_elem* b, void* _);
+static void timer_advance (int64_t);
+static void wheel_add (struct thread *);
+static void wheel_expire (void);
+static int wheel_cascade (int level);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void)
 {
+  int i, level;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
-  list_init (&sleeping_list);
+
+  for (i = 0; i < NEAR_SLOTS; i++)
+    list_init (&near_wheel[i]);
+  for (level = 0; level < OUTER_LEVELS; level++)
+    for (i = 0; i < OUTER_SLOTS; i++)
+      list_init (&outer_wheel[level][i]);
+  wheel_tick = ticks + 1;
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -90,20 +152,6 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-/* Compare should thread A wake up first */
-bool
-timer_compare (const struct list_elem* a, const struct list_elem* b, void* _ UNUSED){
-    if (list_entry (a, struct thread, elem)->sleep_end_tick
-        != list_entry (b, struct thread, elem)->sleep_end_tick)
-    {
-    return list_entry (a, struct thread, elem)->sleep_end_tick
-        < list_entry (b, struct thread, elem)->sleep_end_tick;
-    }else{
-    return list_entry (a, struct thread, elem)->priority
-        > list_entry (b, struct thread, elem)->priority;
-    }
-}
-
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -117,7 +165,7 @@ timer_sleep (int64_t t)
   level = intr_disable ();
   while (cur->sleep_end_tick > ticks)
   {
-    list_insert_ordered (&sleeping_list, &cur->elem, timer_compare, NULL);
+    wheel_add (cur);
     thread_block ();
   }
   intr_set_level (level);
@@ -193,22 +241,207 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Returns the longest time, in TSC cycles, that a single timer
+   interrupt has spent with interrupts off since the last call to
+   timer_reset_interrupt_stats(). */
+uint64_t
+timer_max_interrupt_cycles (void)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t cycles = max_interrupt_cycles;
+  intr_set_level (old_level);
+  return cycles;
+}
+
+/* Restarts measurement of timer interrupt latency. */
+void
+timer_reset_interrupt_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  max_interrupt_cycles = 0;
+  intr_set_level (old_level);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
-  while (!list_empty (&sleeping_list)) {
-    struct thread * nthread = list_entry (list_front (&sleeping_list), struct thread, elem);
-    if (nthread->sleep_end_tick <= ticks){
-      list_pop_front (&sleeping_list);
-      thread_unblock (nthread);
-	  intr_yield_on_return();
+  uint64_t start = rdtsc ();
+  uint64_t cycles;
+
+  timer_advance (1);
+
+  cycles = rdtsc () - start;
+  if (cycles > max_interrupt_cycles)
+    max_interrupt_cycles = cycles;
+}
+
+/* Called by the idle thread, with interrupts off, right before
+   it halts.  In tickless mode, replaces the periodic tick by a
+   one-shot interrupt at the next tick that has work to do. */
+void
+timer_idle_enter (void)
+{
+  int n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || in_oneshot)
+    return;
+
+  /* Count the upcoming ticks with nothing due.  A near wheel
+     wrap-around cascades outer wheels, which may make a sleeper
+     due, so stop there too. */
+  for (n = 1; n < TICKLESS_MAX; n++)
+    {
+      int64_t t = ticks + n;
+      if (!list_empty (&near_wheel[t & NEAR_MASK]) || (t & NEAR_MASK) == 0)
+        break;
+    }
+  if (n <= 1)
+    return;
+
+  in_oneshot = true;
+  oneshot_ticks = n;
+  pit_start_oneshot (0, n * PIT_COUNT_PER_TICK);
+}
+
+/* Called at the start of every external interrupt.  If the PIT
+   was left in one-shot mode by timer_idle_enter(), catches up on
+   the ticks that elapsed meanwhile and restores the periodic
+   tick. */
+void
+timer_idle_exit (void)
+{
+  bool expired;
+  uint16_t left;
+  int elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!in_oneshot)
+    return;
+
+  left = pit_read_count (0, &expired);
+  if (expired)
+    {
+      /* The one-shot interrupt is pending (or is the interrupt
+         being handled) and will account for the final tick. */
+      elapsed = oneshot_ticks - 1;
+    }
+  else
+    {
+      /* Carry the part of a tick that elapsed, so that frequent
+         early wakeups still add up to whole ticks. */
+      int counts = (oneshot_ticks * PIT_COUNT_PER_TICK - left
+                    + oneshot_remainder);
+      elapsed = counts / PIT_COUNT_PER_TICK;
+      oneshot_remainder = counts % PIT_COUNT_PER_TICK;
+    }
+
+  in_oneshot = false;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  timer_advance (elapsed);
+}
+
+/* Accounts for N timer ticks: runs the scheduler's per-tick work
+   for each and wakes up sleepers that became due. */
+static void
+timer_advance (int64_t n)
+{
+  while (n-- > 0)
+    {
+      ticks++;
+      thread_tick ();
+    }
+  wheel_expire ();
+}
+
+/* Files sleeping thread T in the wheel slot that covers its
+   sleep_end_tick.  Interrupts must be off. */
+static void
+wheel_add (struct thread *t)
+{
+  int64_t expires = t->sleep_end_tick;
+  int64_t delta = expires - wheel_tick;
+  struct list *slot;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    {
+      /* Already due: expire on the next tick we process. */
+      slot = &near_wheel[wheel_tick & NEAR_MASK];
+    }
+  else if (delta < NEAR_SLOTS)
+    slot = &near_wheel[expires & NEAR_MASK];
+  else
+    {
+      int shift = NEAR_BITS;
+
+      for (level = 0; level < OUTER_LEVELS - 1; level++)
+        {
+          if (delta < (int64_t) 1 << (shift + OUTER_BITS))
+            break;
+          shift += OUTER_BITS;
+        }
+      if (level == OUTER_LEVELS - 1
+          && delta >= (int64_t) 1 << (shift + OUTER_BITS))
+        {
+          /* Beyond the last wheel: park in its farthest slot.  The
+             thread will be refiled when that slot cascades. */
+          expires = wheel_tick + ((int64_t) OUTER_MASK << shift);
+        }
+      slot = &outer_wheel[level][(expires >> shift) & OUTER_MASK];
+    }
+  list_push_back (slot, &t->elem);
+}
+
+/* Moves every thread in the current slot of outer wheel LEVEL
+   into finer slots.  Returns the index of that slot, which is 0
+   when LEVEL itself has wrapped around. */
+static int
+wheel_cascade (int level)
+{
+  int shift = NEAR_BITS + level * OUTER_BITS;
+  int idx = (wheel_tick >> shift) & OUTER_MASK;
+  struct list *slot = &outer_wheel[level][idx];
+
+  while (!list_empty (slot))
+    wheel_add (list_entry (list_pop_front (slot), struct thread, elem));
+  return idx;
+}
+
+/* Wakes up every thread whose sleep ends at or before the
+   current tick.  Called from the timer interrupt. */
+static void
+wheel_expire (void)
+{
+  while (wheel_tick <= ticks)
+    {
+      int idx = wheel_tick & NEAR_MASK;
+      struct list *slot = &near_wheel[idx];
+
+      /* The near wheel wrapped: pull in the next slot of each
+         outer wheel that wrapped as well. */
+      if (idx == 0)
+        {
+          int level;
+          for (level = 0; level < OUTER_LEVELS; level++)
+            if (wheel_cascade (level) != 0)
+              break;
+        }
+
+      wheel_tick++;
+      while (!list_empty (slot))
+        {
+          struct thread *t = list_entry (list_pop_front (slot),
+                                         struct thread, elem);
+          thread_unblock (t);
+          intr_yield_on_return ();
+        }
     }
-    else
-      break;
-  }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
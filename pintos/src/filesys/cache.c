@@ -0,0 +1,337 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Milliseconds between flushes of dirty sectors to disk. */
+#define CACHE_FLUSH_INTERVAL 1000
+
+/* Maximum number of sectors waiting to be read ahead. */
+#define READ_AHEAD_QUEUE 32
+
+/* A cached file system sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* True if SECTOR is cached here. */
+    bool dirty;                         /* Modified since last written. */
+    bool accessed;                      /* Used since the clock hand passed. */
+    bool busy;                          /* Being read or written. */
+    int pin_cnt;                        /* Callers copying in or out. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects every entry's metadata.  DATA is only touched by
+   callers that have pinned the entry, or by the thread that set
+   BUSY. */
+static struct lock cache_lock;
+
+/* Signaled when an entry stops being busy or pinned. */
+static struct condition cache_io_done;
+
+/* Clock hand for eviction. */
+static size_t clock_hand;
+
+/* Sectors waiting for the read-ahead thread, protected by
+   cache_lock. */
+static block_sector_t ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head, ra_cnt;
+static struct condition ra_ready;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Found in the cache. */
+static unsigned long long miss_cnt;     /* Read or zeroed on a miss. */
+static unsigned long long evict_cnt;    /* Dirty sectors written to evict. */
+static unsigned long long flush_cnt;    /* Dirty sectors written by flushes. */
+static unsigned long long ra_read_cnt;  /* Sectors read ahead. */
+static unsigned long long ra_drop_cnt;  /* Read-aheads dropped, queue full. */
+
+static void flusher (void *aux);
+static void read_ahead (void *aux);
+
+/* Initializes the buffer cache and starts the threads that write
+   dirty sectors behind and read sectors ahead. */
+void
+cache_init (void)
+{
+  lock_init (&cache_lock);
+  cond_init (&cache_io_done);
+  cond_init (&ra_ready);
+  if (thread_create ("flusher", PRI_DEFAULT, flusher, NULL) == TID_ERROR)
+    PANIC ("Can't create flusher thread.");
+  if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL) == TID_ERROR)
+    PANIC ("Can't create read-ahead thread.");
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to reuse with the clock algorithm, writing it
+   back first if it is dirty.  Returns a null pointer if the entry
+   chosen had to be written back, since cache_lock was released
+   meanwhile and the caller must look again.  Waits if every entry
+   is in use.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  struct cache_entry *ce;
+  size_t i;
+
+  for (;;)
+    {
+      /* Two sweeps clear every accessed bit, so the second finds
+         a victim unless all entries are pinned or busy. */
+      for (i = 0; i < 2 * CACHE_SIZE; i++)
+        {
+          ce = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+          if (ce->busy || ce->pin_cnt > 0)
+            continue;
+          if (!ce->valid)
+            return ce;
+          if (ce->accessed)
+            ce->accessed = false;
+          else
+            goto found;
+        }
+      cond_wait (&cache_io_done, &cache_lock);
+    }
+
+ found:
+  if (!ce->dirty)
+    return ce;
+
+  ce->busy = true;
+  ce->dirty = false;
+  lock_release (&cache_lock);
+  block_write (fs_device, ce->sector, ce->data);
+  lock_acquire (&cache_lock);
+  ce->busy = false;
+  evict_cnt++;
+  cond_broadcast (&cache_io_done, &cache_lock);
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned, reading it from disk
+   unless the caller is about to overwrite all of it, in which
+   case a miss starts with zeros.  The caller must unpin it with
+   cache_unpin(). */
+static struct cache_entry *
+cache_pin (block_sector_t sector, bool overwrite)
+{
+  struct cache_entry *ce;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      ce = cache_lookup (sector);
+      if (ce != NULL)
+        {
+          if (ce->busy)
+            {
+              cond_wait (&cache_io_done, &cache_lock);
+              continue;
+            }
+          hit_cnt++;
+          break;
+        }
+
+      ce = cache_evict ();
+      if (ce == NULL)
+        continue;
+
+      ce->sector = sector;
+      ce->valid = true;
+      ce->dirty = false;
+      miss_cnt++;
+      if (overwrite)
+        {
+          memset (ce->data, 0, BLOCK_SECTOR_SIZE);
+          break;
+        }
+      ce->busy = true;
+      lock_release (&cache_lock);
+      block_read (fs_device, sector, ce->data);
+      lock_acquire (&cache_lock);
+      ce->busy = false;
+      cond_broadcast (&cache_io_done, &cache_lock);
+      break;
+    }
+  ce->pin_cnt++;
+  ce->accessed = true;
+  lock_release (&cache_lock);
+  return ce;
+}
+
+/* Unpins CE, marking it dirty if DIRTY. */
+static void
+cache_unpin (struct cache_entry *ce, bool dirty)
+{
+  lock_acquire (&cache_lock);
+  if (dirty)
+    ce->dirty = true;
+  if (--ce->pin_cnt == 0)
+    cond_broadcast (&cache_io_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *ce;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  ce = cache_pin (sector, false);
+  memcpy (buffer, ce->data + ofs, size);
+  cache_unpin (ce, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER starting at byte OFS within
+   SECTOR.  The sector reaches the disk when it is evicted or
+   flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *ce;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+  ce = cache_pin (sector, size == BLOCK_SECTOR_SIZE);
+  memcpy (ce->data + ofs, buffer, size);
+  cache_unpin (ce, true);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache, and
+   returns without waiting.  Does nothing if SECTOR is already
+   cached or too many sectors are already waiting. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (cache_lookup (sector) == NULL)
+    {
+      if (ra_cnt < READ_AHEAD_QUEUE)
+        {
+          ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+          cond_signal (&ra_ready, &cache_lock);
+        }
+      else
+        ra_drop_cnt++;
+    }
+  lock_release (&cache_lock);
+}
+
+/* Reads the sectors queued by cache_read_ahead() into the cache,
+   so that a reader finds them there or waits only for the rest of
+   a read already under way. */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached;
+
+      lock_acquire (&cache_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_ready, &cache_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+      ra_cnt--;
+      cached = cache_lookup (sector) != NULL;
+      if (!cached)
+        ra_read_cnt++;
+      lock_release (&cache_lock);
+
+      if (!cached)
+        cache_unpin (cache_pin (sector, false), false);
+    }
+}
+
+/* Writes every dirty sector to disk. */
+void
+cache_flush (void)
+{
+  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *ce = &cache[i];
+      if (!ce->valid || !ce->dirty || ce->busy)
+        continue;
+
+      /* Write a copy, so that pinned writers can keep going.  A
+         write that lands after the copy dirties the entry again. */
+      memcpy (buffer, ce->data, BLOCK_SECTOR_SIZE);
+      ce->dirty = false;
+      ce->busy = true;
+      lock_release (&cache_lock);
+      block_write (fs_device, ce->sector, buffer);
+      lock_acquire (&cache_lock);
+      ce->busy = false;
+      flush_cnt++;
+      cond_broadcast (&cache_io_done, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Flushes the cache every CACHE_FLUSH_INTERVAL milliseconds. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (CACHE_FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu evictions written, "
+          "%llu sectors flushed\n",
+          hit_cnt, miss_cnt, evict_cnt, flush_cnt);
+  printf ("Cache: %llu sectors read ahead, %llu read-aheads dropped\n",
+          ra_read_cnt, ra_drop_cnt);
+}
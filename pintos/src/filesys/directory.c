@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* A directory. */
 struct dir
@@ -21,12 +24,168 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A hashed directory starts with a header sector, followed by
+   BUCKET_CNT bucket sectors.  An entry goes in the bucket its
+   name hashes to, or if that is full, the next bucket with room.
+   A directory without the magic number is treated as empty and
+   can't be added to. */
+#define DIR_MAGIC 0x48444952
+
+/* Entries per bucket. */
+#define DIR_BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Start of the header sector of a hashed directory.  The rest of
+   the sector is not used. */
+struct dir_header
+  {
+    unsigned magic;                     /* DIR_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+  };
+
+/* A bucket sector of a hashed directory. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES]; /* Entries. */
+    uint32_t overflow;                  /* Nonzero if an entry that hashes
+                                           here is in a later bucket. */
+    uint32_t unused[2];                 /* Not used. */
+  };
+
+/* Directory entry cache: recently looked up names, so that looking
+   up a hot name doesn't read the directory at all.  Direct mapped
+   by directory and name. */
+#define DCACHE_SIZE 64
+
+struct dcache_entry
+  {
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    block_sector_t inode_sector;        /* Sector of the named inode. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool valid;                         /* Holds a name? */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+
+/* Returns the entry cache slot for NAME in the directory whose
+   inode is in DIR_SECTOR. */
+static struct dcache_entry *
+dcache_slot (block_sector_t dir_sector, const char *name)
+{
+  return &dcache[(hash_int (dir_sector) ^ hash_string (name)) % DCACHE_SIZE];
+}
+
+/* Looks up NAME in the directory whose inode is in DIR_SECTOR.
+   Returns true and sets *INODE_SECTOR if the entry cache holds
+   it. */
+static bool
+dcache_lookup (block_sector_t dir_sector, const char *name,
+               block_sector_t *inode_sector)
+{
+  struct dcache_entry *de = dcache_slot (dir_sector, name);
+  if (de->valid && de->dir_sector == dir_sector && !strcmp (de->name, name))
+    {
+      *inode_sector = de->inode_sector;
+      return true;
+    }
+  return false;
+}
+
+/* Remembers that NAME in the directory whose inode is in
+   DIR_SECTOR refers to INODE_SECTOR. */
+static void
+dcache_insert (block_sector_t dir_sector, const char *name,
+               block_sector_t inode_sector)
+{
+  struct dcache_entry *de = dcache_slot (dir_sector, name);
+  de->dir_sector = dir_sector;
+  de->inode_sector = inode_sector;
+  strlcpy (de->name, name, sizeof de->name);
+  de->valid = true;
+}
+
+/* Forgets NAME in the directory whose inode is in DIR_SECTOR. */
+static void
+dcache_remove (block_sector_t dir_sector, const char *name)
+{
+  struct dcache_entry *de = dcache_slot (dir_sector, name);
+  if (de->valid && de->dir_sector == dir_sector && !strcmp (de->name, name))
+    de->valid = false;
+}
+
+/* Slab cache for `struct dir'. */
+static struct kmem_cache *dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+}
+
+/* Returns the byte offset of bucket BUCKET in a hashed
+   directory. */
+static off_t
+bucket_ofs (size_t bucket)
+{
+  return (bucket + 1) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of entry IDX of bucket BUCKET in a
+   hashed directory. */
+static off_t
+entry_ofs (size_t bucket, size_t idx)
+{
+  return bucket_ofs (bucket) + idx * sizeof (struct dir_entry);
+}
+
+/* Returns the byte offset of bucket BUCKET's overflow flag. */
+static off_t
+overflow_ofs (size_t bucket)
+{
+  return bucket_ofs (bucket) + offsetof (struct dir_bucket, overflow);
+}
+
+/* Reads INODE's header into *H.  Returns true if successful,
+   false if INODE is not a hashed directory. */
+static bool
+read_header (struct inode *inode, struct dir_header *h)
+{
+  return (inode_read_at (inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == DIR_MAGIC);
+}
+
+/* Writes *H as INODE's header.  Returns true if successful. */
+static bool
+write_header (struct inode *inode, const struct dir_header *h)
+{
+  return inode_write_at (inode, h, sizeof *h, 0) == sizeof *h;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR.  The directory grows as entries are added.
+   Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+  bool success;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  h.magic = DIR_MAGIC;
+  h.entry_cnt = 0;
+  h.bucket_cnt = DIV_ROUND_UP (entry_cnt * 4, DIR_BUCKET_ENTRIES * 3);
+  if (h.bucket_cnt == 0)
+    h.bucket_cnt = 1;
+  if (!inode_create (sector, bucket_ofs (h.bucket_cnt)))
+    return false;
+
+  inode = inode_open (sector);
+  success = inode != NULL && write_header (inode, &h);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,7 +193,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode)
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -44,7 +203,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL;
     }
 }
@@ -72,7 +231,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -83,6 +242,44 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Searches hashed directory DIR, with header H, for a file with
+   the given NAME.  Same interface as lookup(). */
+static bool
+hashed_lookup (const struct dir *dir, const struct dir_header *h,
+               const char *name, struct dir_entry *ep, off_t *ofsp)
+{
+  size_t bucket = hash_string (name) % h->bucket_cnt;
+  size_t n, i;
+
+  for (n = 0; n < h->bucket_cnt; n++)
+    {
+      struct dir_entry e;
+      uint32_t overflow;
+
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        {
+          off_t ofs = entry_ofs (bucket, i);
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            return false;
+          if (e.in_use && !strcmp (name, e.name))
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+        }
+
+      if (inode_read_at (dir->inode, &overflow, sizeof overflow,
+                         overflow_ofs (bucket)) != sizeof overflow
+          || !overflow)
+        break;
+      bucket = (bucket + 1) % h->bucket_cnt;
+    }
+  return false;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -92,22 +289,88 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_header h;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  return (read_header (dir->inode, &h)
+          && hashed_lookup (dir, &h, name, ep, ofsp));
+}
+
+/* Puts E in hashed directory DIR, with header H, in the first
+   free slot starting from the bucket its name hashes to.  E's
+   name must not already be in DIR.  Doesn't update H's entry
+   count.  Returns true if successful, false if every bucket is
+   full or a disk error occurs. */
+static bool
+hashed_insert (struct dir *dir, const struct dir_header *h,
+               const struct dir_entry *e)
+{
+  size_t bucket = hash_string (e->name) % h->bucket_cnt;
+  size_t n, i;
+
+  for (n = 0; n < h->bucket_cnt; n++)
+    {
+      static const uint32_t overflow = 1;
+
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        {
+          off_t ofs = entry_ofs (bucket, i);
+          struct dir_entry old;
+          if (inode_read_at (dir->inode, &old, sizeof old, ofs) != sizeof old)
+            return false;
+          if (!old.in_use)
+            return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+        }
+
+      /* Full, so lookups of names hashing here must go on. */
+      if (inode_write_at (dir->inode, &overflow, sizeof overflow,
+                          overflow_ofs (bucket)) != sizeof overflow)
+        return false;
+      bucket = (bucket + 1) % h->bucket_cnt;
+    }
+  return false;
+}
+
+/* Doubles the number of buckets in hashed directory DIR, with
+   header H, and rehashes its entries.  Returns true if
+   successful.  On failure, DIR is unchanged. */
+static bool
+hashed_grow (struct dir *dir, struct dir_header *h)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+  size_t old_cnt = h->bucket_cnt;
+  size_t old_size = old_cnt * BLOCK_SECTOR_SIZE;
+  struct dir_bucket *old;
+  size_t b, i;
+  bool success = true;
+
+  /* Read the old buckets, and make room for the new ones before
+     touching anything, so that a full disk leaves DIR as it was. */
+  old = malloc (old_size);
+  if (old == NULL)
+    return false;
+  if (inode_read_at (dir->inode, old, old_size, bucket_ofs (0)) != (off_t) old_size)
+    goto fail;
+  for (b = old_cnt; b < 2 * old_cnt; b++)
+    if (inode_write_at (dir->inode, zeros, sizeof zeros, bucket_ofs (b))
+        != sizeof zeros)
+      goto fail;
+
+  for (b = 0; b < old_cnt; b++)
+    inode_write_at (dir->inode, zeros, sizeof zeros, bucket_ofs (b));
+  h->bucket_cnt = 2 * old_cnt;
+  for (b = 0; b < old_cnt; b++)
+    for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+      if (old[b].entries[i].in_use)
+        success = hashed_insert (dir, h, &old[b].entries[i]) && success;
+  success = write_header (dir->inode, h) && success;
+  free (old);
+  return success;
+
+ fail:
+  free (old);
   return false;
 }
 
@@ -119,13 +382,20 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  block_sector_t inode_sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (dcache_lookup (dir_sector, name, &inode_sector))
+    *inode = inode_open (inode_sector);
+  else if (lookup (dir, name, &e, NULL))
+    {
+      dcache_insert (dir_sector, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
     *inode = NULL;
 
@@ -141,8 +411,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_header h;
   struct dir_entry e;
-  off_t ofs;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -156,25 +426,25 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  if (!read_header (dir->inode, &h))
+    goto done;
 
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Keep buckets at most 3/4 full, so probes stay short. */
+  if ((h.entry_cnt + 1) * 4 > h.bucket_cnt * DIR_BUCKET_ENTRIES * 3)
+    hashed_grow (dir, &h);
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!hashed_insert (dir, &h, &e))
+    goto done;
+  h.entry_cnt++;
+  success = write_header (dir->inode, &h);
 
  done:
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
   return success;
 }
 
@@ -184,6 +454,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name)
 {
+  struct dir_header h;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -202,9 +473,15 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
 
   /* Erase directory entry. */
+  dcache_remove (inode_get_inumber (dir->inode), name);
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  if (read_header (dir->inode, &h))
+    {
+      h.entry_cnt--;
+      write_header (dir->inode, &h);
+    }
 
   /* Remove inode. */
   inode_remove (inode);
@@ -221,10 +498,23 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  if (!read_header (dir->inode, &h))
+    return false;
+
+  for (;;)
     {
+      /* Skip the header and the tail of each bucket. */
+      if (dir->pos < bucket_ofs (0))
+        dir->pos = bucket_ofs (0);
+      if ((dir->pos % BLOCK_SECTOR_SIZE) / sizeof e >= DIR_BUCKET_ENTRIES)
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+      if (dir->pos >= bucket_ofs (h.bucket_cnt))
+        break;
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
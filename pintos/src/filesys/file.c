@@ -3,12 +3,19 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in sectors. */
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 32
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of the bytes read ahead so far. */
+    int ra_window;              /* Sectors to read ahead, 0 if random. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +30,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -60,6 +70,37 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Before a read of SIZE bytes at FILE's current position, starts
+   reading ahead of it if FILE has been read sequentially.  The
+   window doubles on each sequential read, up to READ_AHEAD_MAX
+   sectors, and collapses when FILE is read anywhere else. */
+static void
+file_read_ahead (struct file *file, off_t size)
+{
+  off_t start, end;
+
+  if (file->pos != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+      return;
+    }
+  if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window *= 2;
+
+  start = file->pos + size;
+  if (start < file->ra_end)
+    start = file->ra_end;
+  end = file->pos + size + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, end - start, start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -68,8 +109,12 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  file_read_ahead (file, size);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
   return bytes_read;
 }
 
@@ -87,9 +132,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
@@ -102,9 +146,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
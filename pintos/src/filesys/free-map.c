@@ -40,6 +40,30 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT consecutive sectors starting at SECTOR,
+   stopping at the first one already in use, and returns how many
+   were allocated.  Returns 0 if SECTOR is in use or if the
+   free_map file could not be written. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  size_t got = 0;
+
+  while (got < cnt && sector + got < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + got))
+    got++;
+  if (got > 0)
+    {
+      bitmap_set_multiple (free_map, sector, got, true);
+      if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
+        {
+          bitmap_set_multiple (free_map, sector, got, false);
+          got = 0;
+        }
+    }
+  return got;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
@@ -55,7 +79,7 @@ free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
-    PANIC ("can't open free map");
+    PANIC ("can't open free map (reformat disks from before extents with -f)");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
 }
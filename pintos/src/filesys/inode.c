@@ -1,23 +1,57 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Identifies an inode.  Inodes from before extents had magic
+   0x494e4f44, so a disk formatted then is refused. */
+#define INODE_MAGIC 0x494e4f45
+
+/* Number of buckets in the table of inodes in memory. */
+#define INODE_BUCKETS 64
+
+/* Maximum number of closed inodes kept in memory. */
+#define CLOSED_INODE_MAX 32
+
+/* A run of consecutive data sectors. */
+struct extent
+  {
+    uint32_t offset;                    /* First sector within the file. */
+    block_sector_t start;               /* First sector on disk. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extents held in the inode itself, and in its indirect block. */
+#define DIRECT_EXTENTS 41
+#define INDIRECT_EXTENTS 42
+#define MAX_EXTENTS (DIRECT_EXTENTS + INDIRECT_EXTENTS)
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    block_sector_t indirect;            /* Indirect extent block, or 0. */
+    struct extent extents[DIRECT_EXTENTS]; /* First extents, in order. */
+    uint32_t unused[1];                 /* Not used. */
+  };
+
+/* Indirect extent block, holding the extents after the first
+   DIRECT_EXTENTS.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent extents[INDIRECT_EXTENTS]; /* Later extents, in order. */
+    uint32_t unused[2];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,14 +65,39 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem elem;              /* Element in an `inodes' bucket. */
+    struct list_elem closed_elem;       /* Element in `closed_inodes'. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    struct extent_block indirect;       /* Indirect block content. */
   };
 
+/* Returns extent IDX of INODE. */
+static struct extent *
+inode_extent (const struct inode *inode, size_t idx)
+{
+  ASSERT (idx < MAX_EXTENTS);
+  if (idx < DIRECT_EXTENTS)
+    return (struct extent *) &inode->data.extents[idx];
+  else
+    return (struct extent *) &inode->indirect.extents[idx - DIRECT_EXTENTS];
+}
+
+/* Returns the number of data sectors allocated to INODE. */
+static size_t
+inode_sectors (const struct inode *inode)
+{
+  struct extent *e;
+
+  if (inode->data.extent_cnt == 0)
+    return 0;
+  e = inode_extent (inode, inode->data.extent_cnt - 1);
+  return e->offset + e->length;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -46,22 +105,150 @@ struct inode
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos)
 {
+  size_t idx, lo, hi;
+  struct extent *e;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos >= inode->data.length)
     return -1;
+
+  /* Binary search for the last extent starting at or before IDX. */
+  idx = pos / BLOCK_SECTOR_SIZE;
+  lo = 0;
+  hi = inode->data.extent_cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode_extent (inode, mid)->offset <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  e = inode_extent (inode, lo);
+  ASSERT (idx >= e->offset && idx < e->offset + e->length);
+  return e->start + (idx - e->offset);
+}
+
+/* Fills CNT sectors starting at SECTOR with zeros. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  while (cnt-- > 0)
+    cache_write (sector++, zeros);
+}
+
+/* Allocates data sectors to INODE until it has room for LENGTH
+   bytes, zeroing them.  Grows the last extent in place when the
+   sectors after it are free, and otherwise adds extents as large
+   as the free map allows, so that files stay mostly contiguous.
+   Returns false if the disk or the extent table fills up, in which
+   case INODE keeps what was allocated so far.  Doesn't change
+   INODE's length or write it to disk. */
+static bool
+inode_extend (struct inode *inode, off_t length)
+{
+  size_t have = inode_sectors (inode);
+  size_t need = bytes_to_sectors (length);
+
+  while (have < need)
+    {
+      size_t cnt = need - have;
+      struct extent *e;
+      block_sector_t start;
+
+      if (inode->data.extent_cnt > 0)
+        {
+          e = inode_extent (inode, inode->data.extent_cnt - 1);
+          cnt = free_map_extend (e->start + e->length, cnt);
+          if (cnt > 0)
+            {
+              zero_sectors (e->start + e->length, cnt);
+              e->length += cnt;
+              have += cnt;
+              continue;
+            }
+          cnt = need - have;
+        }
+
+      if (inode->data.extent_cnt == MAX_EXTENTS)
+        return false;
+      while (cnt > 0 && !free_map_allocate (cnt, &start))
+        cnt /= 2;
+      if (cnt == 0)
+        return false;
+      if (inode->data.extent_cnt == DIRECT_EXTENTS
+          && !free_map_allocate (1, &inode->data.indirect))
+        {
+          free_map_release (start, cnt);
+          return false;
+        }
+
+      zero_sectors (start, cnt);
+      e = inode_extent (inode, inode->data.extent_cnt++);
+      e->offset = have;
+      e->start = start;
+      e->length = cnt;
+      have += cnt;
+    }
+  return true;
+}
+
+/* Writes INODE's on-disk inode and indirect block. */
+static void
+inode_write_disk (struct inode *inode)
+{
+  cache_write (inode->sector, &inode->data);
+  if (inode->data.extent_cnt > DIRECT_EXTENTS)
+    cache_write (inode->data.indirect, &inode->indirect);
+}
+
+/* Releases INODE's data sectors and indirect block. */
+static void
+inode_release (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    {
+      struct extent *e = inode_extent (inode, i);
+      free_map_release (e->start, e->length);
+    }
+  if (inode->data.extent_cnt > DIRECT_EXTENTS)
+    free_map_release (inode->data.indirect, 1);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Inodes in memory, hashed by sector, so that opening a single
+   inode twice returns the same `struct inode'.  Holds open inodes
+   and the closed ones in `closed_inodes'. */
+static struct list inodes[INODE_BUCKETS];
+
+/* Recently closed inodes, most recent first, kept so that
+   reopening them needs no disk read. */
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Slab cache for `struct inode'. */
+static struct kmem_cache *inode_cache;
+
+/* Returns the `inodes' bucket for the inode in SECTOR. */
+static struct list *
+inode_bucket (block_sector_t sector)
+{
+  return &inodes[hash_int (sector) % INODE_BUCKETS];
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < INODE_BUCKETS; i++)
+    list_init (&inodes[i]);
+  list_init (&closed_inodes);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -72,72 +259,84 @@ inode_init (void)
 bool
 inode_create (block_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
+  struct inode *inode = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
+  /* If these assertions fail, the inode structures are not exactly
      one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof inode->data == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof inode->indirect == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  inode = kmem_cache_alloc (inode_cache);
+  if (inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
+      memset (inode, 0, sizeof *inode);
+      inode->sector = sector;
+      inode->data.length = length;
+      inode->data.magic = INODE_MAGIC;
+      if (inode_extend (inode, length))
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          inode_write_disk (inode);
           success = true;
         }
-      free (disk_inode);
+      else
+        inode_release (inode);
+      kmem_cache_free (inode_cache, inode);
     }
   return success;
 }
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails or if SECTOR
+   doesn't hold an inode in the current format. */
 struct inode *
 inode_open (block_sector_t sector)
 {
+  struct list *bucket = inode_bucket (sector);
   struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  /* Check whether this inode is already open or recently closed. */
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector)
         {
+          if (inode->open_cnt == 0)
+            {
+              list_remove (&inode->closed_elem);
+              closed_cnt--;
+            }
           inode_reopen (inode);
           return inode;
         }
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  list_push_front (bucket, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  cache_read (inode->sector, &inode->data);
+  if (inode->data.magic != INODE_MAGIC
+      || inode->data.extent_cnt > MAX_EXTENTS)
+    {
+      /* Not an inode, or one from before extents. */
+      list_remove (&inode->elem);
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+  if (inode->data.extent_cnt > DIRECT_EXTENTS)
+    cache_read (inode->data.indirect, &inode->indirect);
   return inode;
 }
 
@@ -158,8 +357,11 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, freeing the least recently closed one
+   if there are too many.
+   If INODE was also a removed inode, frees its blocks and its
+   memory. */
 void
 inode_close (struct inode *inode)
 {
@@ -170,18 +372,27 @@ inode_close (struct inode *inode)
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          list_remove (&inode->elem);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          inode_release (inode);
+          kmem_cache_free (inode_cache, inode);
+          return;
         }
 
-      free (inode);
+      /* The on-disk inode is written whenever it changes, so the
+         copy in memory stays good while closed. */
+      list_push_front (&closed_inodes, &inode->closed_elem);
+      if (++closed_cnt > CLOSED_INODE_MAX)
+        {
+          struct inode *old = list_entry (list_pop_back (&closed_inodes),
+                                          struct inode, closed_elem);
+          closed_cnt--;
+          list_remove (&old->elem);
+          kmem_cache_free (inode_cache, old);
+        }
     }
 }
 
@@ -202,7 +413,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0)
     {
@@ -220,51 +430,59 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Starts reading the sectors that hold the SIZE bytes of INODE
+   starting at OFFSET into the buffer cache, without waiting for
+   them.  Bytes past the end of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    cache_read_ahead (byte_to_sector (inode, offset));
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode, and the gap, if
+   any, reads as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (offset + size > inode_length (inode))
+    {
+      /* Extend as far as we can get sectors for. */
+      off_t length = offset + size;
+      if (!inode_extend (inode, length)
+          && length > (off_t) inode_sectors (inode) * BLOCK_SECTOR_SIZE)
+        length = inode_sectors (inode) * BLOCK_SECTOR_SIZE;
+      if (length > inode_length (inode))
+        inode->data.length = length;
+      inode_write_disk (inode);
+    }
+
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
@@ -281,38 +499,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
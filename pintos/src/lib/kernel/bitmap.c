@@ -69,6 +69,66 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a mask of the bits in the element that contains bit
+   START that lie between START and END, exclusive.
+   END must be greater than START. */
+static inline elem_type
+range_mask (size_t start, size_t end)
+{
+  size_t elem_start = start - start % ELEM_BITS;
+  elem_type mask = (elem_type) -1 << (start % ELEM_BITS);
+  if (end - elem_start < ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - elem_start)) - 1;
+  return mask;
+}
+
+/* Returns the element of B that contains bit BIT_IDX, inverted
+   if VALUE is false, so that bits set to VALUE read as 1. */
+static inline elem_type
+elem_match (const struct bitmap *b, size_t bit_idx, bool value)
+{
+  elem_type e = b->bits[elem_idx (bit_idx)];
+  return value ? e : ~e;
+}
+
+/* Returns the index of the first bit past the element that
+   contains BIT_IDX. */
+static inline size_t
+next_elem (size_t bit_idx)
+{
+  return bit_idx - bit_idx % ELEM_BITS + ELEM_BITS;
+}
+
+/* Returns the number of 1-bits in E. */
+static inline size_t
+elem_popcount (elem_type e)
+{
+  /* Add up bits in pairs, then nibbles, then bytes.  GCC's
+     __builtin_popcount would need libgcc. */
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Whole elements of !VALUE bits are skipped at once. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx = start;
+
+  while (idx < end)
+    {
+      elem_type e = elem_match (b, idx, value) & range_mask (idx, end);
+      if (e != 0)
+        return idx - idx % ELEM_BITS + __builtin_ctzl (e);
+      idx = next_elem (idx);
+    }
+  return end;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -213,18 +273,27 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, as in bitmap_set(). */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
+  size_t end = start + cnt;
   size_t i;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start; i < end; i = next_elem (i))
+    {
+      elem_type *e = &b->bits[elem_idx (i)];
+      elem_type mask = range_mask (i, end);
+      if (value)
+        asm ("orl %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,6 +301,7 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
+  size_t end = start + cnt;
   size_t i, value_cnt;
 
   ASSERT (b != NULL);
@@ -239,9 +309,9 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < end; i = next_elem (i))
+    value_cnt += elem_popcount (elem_match (b, i, value)
+                                & range_mask (i, end));
   return value_cnt;
 }
 
@@ -250,16 +320,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) != start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +363,28 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt)
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      size_t i = start;
+
+      /* Skip to the next bit set to VALUE, then look for a bit
+         set to !VALUE that cuts the group short.  If there is
+         one, no group can start before the bit after it. */
+      while (i <= last)
+        {
+          size_t end;
+
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
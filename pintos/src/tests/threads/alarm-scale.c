@@ -0,0 +1,120 @@
+/* Benchmarks the alarm clock with alarm-multiple style workloads
+   of 10, 100 and 1000 sleepers, each sleeping a different fixed
+   duration several times.  For each workload, reports the
+   longest time a timer interrupt kept interrupts off and checks
+   that every sleeper woke up the expected number of times.
+
+   With sleepers kept in a sorted list, registering a sleeper
+   costs O(n) with interrupts off; with the timing wheel both
+   registration and expiry are O(1) amortized, so the reported
+   maximum should grow much more slowly than the sleeper count.
+   Cycle counts vary between simulators, so they are reported but
+   not compared. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITERATIONS 3
+
+/* Information about the test. */
+struct scale_test
+  {
+    int64_t start;              /* Current time at start of test. */
+    struct semaphore done;      /* Upped by each sleeper on exit. */
+  };
+
+/* Information about an individual sleeper. */
+struct scale_thread
+  {
+    struct scale_test *test;    /* Info shared between all threads. */
+    int duration;               /* Number of ticks to sleep. */
+    int iterations;             /* Iterations counted so far. */
+  };
+
+static void sleeper (void *);
+static void run_workload (int thread_cnt);
+
+void
+test_alarm_scale (void)
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  run_workload (10);
+  run_workload (100);
+  run_workload (1000);
+}
+
+/* Runs THREAD_CNT sleepers to completion and reports the longest
+   timer interrupt seen meanwhile. */
+static void
+run_workload (int thread_cnt)
+{
+  struct scale_test test;
+  struct scale_thread *threads;
+  uint64_t cycles;
+  int i;
+
+  msg ("Creating %d threads to sleep %d times each.",
+       thread_cnt, ITERATIONS);
+
+  threads = malloc (sizeof *threads * thread_cnt);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  /* Give ourselves enough time to create every thread before the
+     first wake-up. */
+  test.start = timer_ticks () + 100 + thread_cnt / 10;
+  sema_init (&test.done, 0);
+
+  for (i = 0; i < thread_cnt; i++)
+    {
+      struct scale_thread *t = threads + i;
+      char name[24];
+
+      t->test = &test;
+      t->duration = 1 + i % 97;
+      t->iterations = 0;
+
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  timer_reset_interrupt_stats ();
+  for (i = 0; i < thread_cnt; i++)
+    sema_down (&test.done);
+  cycles = timer_max_interrupt_cycles ();
+
+  for (i = 0; i < thread_cnt; i++)
+    if (threads[i].iterations != ITERATIONS)
+      fail ("thread %d woke up %d times instead of %d",
+            i, threads[i].iterations, ITERATIONS);
+
+  msg ("%d sleepers: max interrupt-off time per tick %"PRIu64" cycles.",
+       thread_cnt, cycles);
+  free (threads);
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_)
+{
+  struct scale_thread *t = t_;
+  struct scale_test *test = t->test;
+  int i;
+
+  for (i = 1; i <= ITERATIONS; i++)
+    {
+      int64_t sleep_until = test->start + i * t->duration;
+      timer_sleep (sleep_until - timer_ticks ());
+      t->iterations++;
+    }
+  sema_up (&test->done);
+}
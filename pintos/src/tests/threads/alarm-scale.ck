@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Cycle counts depend on the simulator, so only check their form.
+s/per tick \d+ cycles/per tick N cycles/ foreach @output;
+
+compare_output ("run", \@output, [<<'EOF']);
+(alarm-scale) begin
+(alarm-scale) Creating 10 threads to sleep 3 times each.
+(alarm-scale) 10 sleepers: max interrupt-off time per tick N cycles.
+(alarm-scale) Creating 100 threads to sleep 3 times each.
+(alarm-scale) 100 sleepers: max interrupt-off time per tick N cycles.
+(alarm-scale) Creating 1000 threads to sleep 3 times each.
+(alarm-scale) 1000 sleepers: max interrupt-off time per tick N cycles.
+(alarm-scale) end
+EOF
+pass;
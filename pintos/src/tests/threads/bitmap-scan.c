@@ -0,0 +1,146 @@
+/* Benchmarks bitmap_count(), bitmap_contains() and bitmap_scan()
+   on a 1M-bit bitmap against straightforward bit-by-bit versions
+   built on bitmap_test(), and checks that both give the same
+   answers.
+
+   The bitmap looks like a busy page or swap map: almost every
+   bit is set, with scattered clear bits and one run of clear
+   bits near the end, so a scan for the run has to cross
+   nearly the whole map.  Cycle counts vary between simulators,
+   so they are reported but not compared. */
+
+#include <bitmap.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/io.h"
+
+#define BIT_CNT (1024 * 1024)
+#define RUN_CNT 64
+
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static bool slow_contains (const struct bitmap *, size_t start, size_t cnt,
+                           bool value);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static void report (const char *op, uint64_t slow, uint64_t fast);
+
+void
+test_bitmap_scan (void)
+{
+  struct bitmap *b;
+  uint64_t start, slow_cycles, fast_cycles;
+  unsigned seed = 1;
+  size_t run_start = BIT_CNT - 1000;
+  size_t i, slow_result, fast_result;
+
+  b = bitmap_create (BIT_CNT);
+  if (b == NULL)
+    fail ("couldn't create bitmap");
+  msg ("Bitmap of %d bits.", BIT_CNT);
+
+  /* Set every bit except about one in 64, and a run near the
+     end.  No other run of RUN_CNT clear bits is likely. */
+  bitmap_set_all (b, true);
+  for (i = 0; i < BIT_CNT / 64; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      bitmap_reset (b, (seed >> 8) % BIT_CNT);
+    }
+  bitmap_set_multiple (b, run_start, RUN_CNT, false);
+
+  start = rdtsc ();
+  slow_result = slow_count (b, 0, BIT_CNT, false);
+  slow_cycles = rdtsc () - start;
+  start = rdtsc ();
+  fast_result = bitmap_count (b, 0, BIT_CNT, false);
+  fast_cycles = rdtsc () - start;
+  if (slow_result != fast_result)
+    fail ("bitmap_count returned %zu, expected %zu", fast_result,
+          slow_result);
+  report ("count", slow_cycles, fast_cycles);
+
+  start = rdtsc ();
+  slow_result = slow_contains (b, 0, run_start, true);
+  slow_cycles = rdtsc () - start;
+  start = rdtsc ();
+  fast_result = bitmap_contains (b, 0, run_start, true);
+  fast_cycles = rdtsc () - start;
+  if (slow_result != fast_result)
+    fail ("bitmap_contains returned %zu, expected %zu", fast_result,
+          slow_result);
+  start = rdtsc ();
+  slow_result = slow_contains (b, run_start, RUN_CNT, true);
+  slow_cycles += rdtsc () - start;
+  start = rdtsc ();
+  fast_result = bitmap_contains (b, run_start, RUN_CNT, true);
+  fast_cycles += rdtsc () - start;
+  if (slow_result != fast_result)
+    fail ("bitmap_contains returned %zu, expected %zu", fast_result,
+          slow_result);
+  report ("contains", slow_cycles, fast_cycles);
+
+  start = rdtsc ();
+  slow_result = slow_scan (b, 0, RUN_CNT, false);
+  slow_cycles = rdtsc () - start;
+  start = rdtsc ();
+  fast_result = bitmap_scan (b, 0, RUN_CNT, false);
+  fast_cycles = rdtsc () - start;
+  if (slow_result != fast_result)
+    fail ("bitmap_scan returned %zu, expected %zu", fast_result,
+          slow_result);
+  if (fast_result > run_start)
+    fail ("bitmap_scan missed the run at %zu", run_start);
+  report ("scan", slow_cycles, fast_cycles);
+
+  bitmap_destroy (b);
+}
+
+/* Reports the cycles taken by the bit-by-bit and word-at-a-time
+   versions of OP. */
+static void
+report (const char *op, uint64_t slow, uint64_t fast)
+{
+  msg ("%s: %"PRIu64" cycles bit-by-bit, %"PRIu64" cycles word-at-a-time.",
+       op, slow, fast);
+}
+
+/* Bit-by-bit bitmap_count(). */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Bit-by-bit bitmap_contains(). */
+static bool
+slow_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* Bit-by-bit bitmap_scan(). */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!slow_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Cycle counts depend on the simulator, so only check their form.
+s/\d+ cycles/N cycles/g foreach @output;
+
+compare_output ("run", \@output, [<<'EOF']);
+(bitmap-scan) begin
+(bitmap-scan) Bitmap of 1048576 bits.
+(bitmap-scan) count: N cycles bit-by-bit, N cycles word-at-a-time.
+(bitmap-scan) contains: N cycles bit-by-bit, N cycles word-at-a-time.
+(bitmap-scan) scan: N cycles bit-by-bit, N cycles word-at-a-time.
+(bitmap-scan) end
+EOF
+pass;
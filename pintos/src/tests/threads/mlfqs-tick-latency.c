@@ -0,0 +1,86 @@
+/* Measures the longest time a single timer interrupt keeps
+   interrupts off under the advanced scheduler, first with only
+   the main thread and then with many blocked threads.
+
+   Recomputing recent_cpu for every thread once per second makes
+   the second-boundary tick proportional to the number of
+   threads.  With the decay applied lazily, blocked threads add
+   no work to the tick and the two measurements should be close.
+   The cycle counts vary between simulators, so they are reported
+   but not compared. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BLOCKED_CNT 100
+
+static void blocked_thread (void *);
+static uint64_t measure (void);
+
+void
+test_mlfqs_tick_latency (void)
+{
+  struct semaphore start, done;
+  struct semaphore *sema[2] = {&start, &done};
+  uint64_t idle_cycles, blocked_cycles;
+  int i;
+
+  ASSERT (thread_mlfqs);
+
+  msg ("Measuring timer interrupts with no other threads...");
+  idle_cycles = measure ();
+
+  msg ("Creating %d blocked threads...", BLOCKED_CNT);
+  sema_init (&start, 0);
+  sema_init (&done, 0);
+  for (i = 0; i < BLOCKED_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "blocked %d", i);
+      if (thread_create (name, PRI_DEFAULT, blocked_thread, sema)
+          == TID_ERROR)
+        fail ("thread_create failed");
+    }
+
+  msg ("Measuring timer interrupts with %d blocked threads...",
+       BLOCKED_CNT);
+  blocked_cycles = measure ();
+
+  msg ("Waking blocked threads...");
+  for (i = 0; i < BLOCKED_CNT; i++)
+    sema_up (&start);
+  for (i = 0; i < BLOCKED_CNT; i++)
+    sema_down (&done);
+
+  msg ("max interrupt-off time per tick: %"PRIu64" cycles idle, "
+       "%"PRIu64" cycles with %d blocked threads",
+       idle_cycles, blocked_cycles, BLOCKED_CNT);
+  msg ("All blocked threads woke up.");
+}
+
+/* Sleeps across several second boundaries and returns the
+   longest timer interrupt seen meanwhile. */
+static uint64_t
+measure (void)
+{
+  timer_reset_interrupt_stats ();
+  timer_sleep (3 * TIMER_FREQ);
+  return timer_max_interrupt_cycles ();
+}
+
+static void
+blocked_thread (void *sema_)
+{
+  struct semaphore **sema = sema_;
+  struct semaphore *start = sema[0];
+  struct semaphore *done = sema[1];
+
+  sema_down (start);
+  sema_up (done);
+}
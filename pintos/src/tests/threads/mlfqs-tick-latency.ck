@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Cycle counts depend on the simulator, so only check their form.
+s/: \d+ cycles idle, \d+ cycles/: N cycles idle, N cycles/ foreach @output;
+
+compare_output ("run", \@output, [<<'EOF']);
+(mlfqs-tick-latency) begin
+(mlfqs-tick-latency) Measuring timer interrupts with no other threads...
+(mlfqs-tick-latency) Creating 100 blocked threads...
+(mlfqs-tick-latency) Measuring timer interrupts with 100 blocked threads...
+(mlfqs-tick-latency) Waking blocked threads...
+(mlfqs-tick-latency) max interrupt-off time per tick: N cycles idle, N cycles with 100 blocked threads
+(mlfqs-tick-latency) All blocked threads woke up.
+(mlfqs-tick-latency) end
+EOF
+pass;
@@ -0,0 +1,184 @@
+/* Stresses the page allocator with a mix of allocation sizes
+   like those seen in the kernel (single pages for thread stacks
+   and command lines, small runs for big malloc() blocks) in
+   random order, using the otherwise idle user pool.
+
+   Reports the average and longest time taken to allocate, and
+   how fragmented free memory is while half the slots are in use:
+   the share of free pages that are not part of the largest free
+   run.  Finally frees everything and checks that the largest
+   free run is back to what it was at the start.
+
+   palloc-stress runs with the default bitmap allocator,
+   palloc-buddy with "-palloc=buddy".  Cycle counts and page
+   counts differ between the two and between simulators, so they
+   are reported but not compared. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+
+#define SLOT_CNT 64
+#define ROUND_CNT 4000
+
+/* An allocation held by the test. */
+struct slot
+  {
+    void *pages;                /* First page, or null if empty. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static void run_stress (void);
+static size_t count_free_pages (void);
+static size_t largest_free_run (void);
+static size_t pick_page_cnt (unsigned *seed);
+
+void
+test_palloc_stress (void)
+{
+  run_stress ();
+}
+
+void
+test_palloc_buddy (void)
+{
+  ASSERT (palloc_buddy);
+  run_stress ();
+}
+
+static void
+run_stress (void)
+{
+  static struct slot slots[SLOT_CNT];
+  uint64_t total_cycles = 0, max_cycles = 0;
+  size_t free_pages, start_largest, largest, held_pages;
+  int alloc_cnt = 0, fail_cnt = 0;
+  unsigned seed = 1;
+  int i;
+
+  free_pages = count_free_pages ();
+  start_largest = largest_free_run ();
+  msg ("%zu free pages, largest free run %zu pages.",
+       free_pages, start_largest);
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      struct slot *s;
+
+      seed = seed * 1103515245 + 12345;
+      s = &slots[(seed >> 16) % SLOT_CNT];
+      if (s->pages != NULL)
+        {
+          palloc_free_multiple (s->pages, s->page_cnt);
+          s->pages = NULL;
+        }
+      else
+        {
+          uint64_t start, cycles;
+
+          s->page_cnt = pick_page_cnt (&seed);
+          start = rdtsc ();
+          s->pages = palloc_get_multiple (PAL_USER, s->page_cnt);
+          cycles = rdtsc () - start;
+
+          alloc_cnt++;
+          total_cycles += cycles;
+          if (cycles > max_cycles)
+            max_cycles = cycles;
+          if (s->pages == NULL)
+            fail_cnt++;
+        }
+    }
+  msg ("%d allocations, %d failed, %"PRIu64" cycles average, "
+       "%"PRIu64" cycles max.", alloc_cnt, fail_cnt,
+       total_cycles / alloc_cnt, max_cycles);
+
+  held_pages = 0;
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].pages != NULL)
+      held_pages += slots[i].page_cnt;
+  largest = largest_free_run ();
+  msg ("Holding %zu pages: %zu free pages, largest free run %zu pages, "
+       "%zu%% fragmented.", held_pages, free_pages - held_pages, largest,
+       free_pages > held_pages
+       ? 100 - 100 * largest / (free_pages - held_pages) : 0);
+
+  for (i = 0; i < SLOT_CNT; i++)
+    if (slots[i].pages != NULL)
+      {
+        palloc_free_multiple (slots[i].pages, slots[i].page_cnt);
+        slots[i].pages = NULL;
+      }
+  if (count_free_pages () != free_pages)
+    fail ("pages leaked");
+  if (largest_free_run () != start_largest)
+    fail ("free pages did not coalesce");
+  msg ("All pages coalesced.");
+}
+
+/* Returns the number of free pages in the user pool. */
+static size_t
+count_free_pages (void)
+{
+  void *head = NULL;
+  void *page;
+  size_t cnt = 0;
+
+  /* Chain the pages through their first word while we hold them. */
+  while ((page = palloc_get_page (PAL_USER)) != NULL)
+    {
+      *(void **) page = head;
+      head = page;
+      cnt++;
+    }
+  while (head != NULL)
+    {
+      page = head;
+      head = *(void **) page;
+      palloc_free_page (page);
+    }
+  return cnt;
+}
+
+/* Returns the largest number of contiguous pages that can be
+   allocated from the user pool. */
+static size_t
+largest_free_run (void)
+{
+  size_t lo = 0, hi = count_free_pages ();
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi + 1) / 2;
+      void *pages = palloc_get_multiple (PAL_USER, mid);
+      if (pages != NULL)
+        {
+          palloc_free_multiple (pages, mid);
+          lo = mid;
+        }
+      else
+        hi = mid - 1;
+    }
+  return lo;
+}
+
+/* Returns a random allocation size, in pages, updating SEED.
+   Mostly single pages, with a tail of larger runs. */
+static size_t
+pick_page_cnt (unsigned *seed)
+{
+  unsigned r;
+
+  *seed = *seed * 1103515245 + 12345;
+  r = (*seed >> 16) % 100;
+  if (r < 50)
+    return 1;
+  else if (r < 75)
+    return 2;
+  else if (r < 90)
+    return 3 + r % 2;
+  else
+    return 5 + r % 12;
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Page and cycle counts depend on the allocator and the
+# simulator, so only check their form.
+s/\d+/N/g foreach @output;
+
+compare_output ("run", \@output, [<<'EOF']);
+(palloc-stress) begin
+(palloc-stress) N free pages, largest free run N pages.
+(palloc-stress) N allocations, N failed, N cycles average, N cycles max.
+(palloc-stress) Holding N pages: N free pages, largest free run N pages, N% fragmented.
+(palloc-stress) All pages coalesced.
+(palloc-stress) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Throughput depends on the simulator, so only check its form.
+s/\d+ MB\/s/N MB\/s/g foreach @output;
+
+compare_output ("run", \@output, [<<'EOF']);
+(string-speed) begin
+(string-speed) Unaligned results match byte loops.
+(string-speed) memcpy 16 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memset 16 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memcpy 64 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memset 64 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memcpy 256 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memset 256 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memcpy 1024 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memset 1024 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memcpy 4096 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) memset 4096 bytes: N MB/s byte loop, N MB/s word loop.
+(string-speed) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Fills a buffer, forks, and has the child overwrite it.  The
+   child must see the parent's data until it writes, and the
+   parent's copy must be untouched afterward. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+static char buf[SIZE];
+
+/* Returns true if all of BUF is C. */
+static bool
+filled_with (char c)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  memset (buf, 'p', SIZE);
+  child = fork ();
+  if (child == 0)
+    {
+      /* Don't print from the child, so output order is fixed. */
+      if (!filled_with ('p'))
+        exit (1);
+      memset (buf, 'c', SIZE);
+      exit (filled_with ('c') ? 0x42 : 2);
+    }
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+  CHECK (filled_with ('p'), "parent's buffer unchanged");
+}
@@ -0,0 +1,62 @@
+/* Fills a buffer larger than physical memory, forks, and has the
+   child check it and overwrite part of it while both processes'
+   pages are swapped out and back in.  Pages shared by fork() must
+   be evicted to swap rather than exhausting memory, and each
+   process must keep seeing its own data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 512
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+static char buf[SIZE];
+
+/* Returns the byte page I of BUF should hold in the parent. */
+static char
+parent_byte (size_t i)
+{
+  return 'A' + i % 26;
+}
+
+/* Returns true if each page I of BUF is filled with the byte
+   parent_byte (I), or with C if I is a multiple of STEP. */
+static bool
+check (size_t step, char c)
+{
+  size_t i, j;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      char want = step && i % step == 0 ? c : parent_byte (i);
+      for (j = 0; j < PAGE_SIZE; j += 512)
+        if (buf[i * PAGE_SIZE + j] != want)
+          return false;
+    }
+  return true;
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, parent_byte (i), PAGE_SIZE);
+  child = fork ();
+  if (child == 0)
+    {
+      /* Don't print from the child, so output order is fixed. */
+      if (!check (0, 0))
+        exit (1);
+      for (i = 0; i < PAGE_CNT; i += 8)
+        memset (buf + i * PAGE_SIZE, 'c', PAGE_SIZE);
+      exit (check (8, 'c') ? 0x42 : 2);
+    }
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+  CHECK (check (0, 0), "parent's buffer unchanged");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-swap) begin
+(fork-swap) fork
+(fork-swap) wait for child
+(fork-swap) parent's buffer unchanged
+(fork-swap) end
+EOF
+pass;
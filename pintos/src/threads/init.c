@@ -103,6 +103,7 @@ main (void)
   paging_init ();
 #ifdef VM
   frame_table_init ();
+  page_init ();
 #endif
 
   /* Segmentation. */
@@ -135,6 +136,7 @@ main (void)
 
 #ifdef VM
   swap_init ();
+  frame_pageout_start ();
 #endif
 
   printf ("Boot complete.\n");
@@ -266,9 +268,35 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-palloc"))
+        {
+          if (value != NULL && !strcmp (value, "buddy"))
+            palloc_buddy = true;
+          else if (value != NULL && !strcmp (value, "bitmap"))
+            palloc_buddy = false;
+          else
+            PANIC ("unknown page allocator `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-clock"))
+        {
+          if (value != NULL && !strcmp (value, "two-handed"))
+            frame_two_handed = true;
+          else if (value != NULL && !strcmp (value, "one-handed"))
+            frame_two_handed = false;
+          else
+            PANIC ("unknown clock policy `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-fault-around"))
+        page_fault_around = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -389,8 +417,15 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -palloc=ALLOC      Use page allocator ALLOC: bitmap (default) or buddy.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -clock=POLICY      Evict pages with POLICY: one-handed (default)\n"
+          "                     or two-handed clock.\n"
+          "  -fault-around=N    Load up to N pages of a file per page fault.\n"
 #endif
           );
   shutdown_power_off ();
@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +34,19 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Blocks of the smallest size classes are additionally cached
+   per thread (see struct malloc_cache).  malloc() and free()
+   work on the running thread's cache without any lock, and only
+   take the descriptor's lock to move MAGAZINE_BATCH blocks at a
+   time between the cache and the descriptor's free list.  Blocks
+   sitting in a cache still count as in use in their arena. */
+
+/* Blocks moved between a thread cache and a descriptor at a time,
+   and the most blocks a thread cache holds per size class. */
+#define MAGAZINE_BATCH 4
+#define MAGAZINE_SIZE (2 * MAGAZINE_BATCH)
 
 /* Descriptor. */
 struct desc
@@ -41,6 +55,13 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    unsigned long long alloc_cnt;   /* Blocks allocated. */
+    unsigned long long freed_cnt;   /* Blocks freed. */
+    unsigned long long hit_cnt;     /* Served by a thread cache. */
+    unsigned long long refill_cnt;  /* Batches moved into a cache. */
+    unsigned long long drain_cnt;   /* Batches moved out of a cache. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -63,9 +84,12 @@ struct block
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
+static unsigned long long big_cnt;  /* Big blocks allocated. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *desc_get_block (struct desc *);
+static void desc_put_block (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -84,6 +108,43 @@ malloc_init (void)
     }
 }
 
+/* Initializes thread cache C to empty. */
+void
+malloc_cache_init (struct malloc_cache *c)
+{
+  size_t i;
+
+  for (i = 0; i < MALLOC_CACHE_CLASSES; i++)
+    {
+      list_init (&c->blocks[i]);
+      c->cnt[i] = 0;
+    }
+}
+
+/* Returns every block in thread cache C to its descriptor.
+   Called by a thread on its own cache before it exits. */
+void
+malloc_cache_drain (struct malloc_cache *c)
+{
+  size_t i;
+
+  for (i = 0; i < MALLOC_CACHE_CLASSES && i < desc_cnt; i++)
+    if (c->cnt[i] > 0)
+      {
+        struct desc *d = &descs[i];
+
+        lock_acquire (&d->lock);
+        while (!list_empty (&c->blocks[i]))
+          {
+            struct list_elem *e = list_pop_front (&c->blocks[i]);
+            desc_put_block (d, list_entry (e, struct block, free_elem));
+          }
+        c->cnt[i] = 0;
+        d->drain_cnt++;
+        lock_release (&d->lock);
+      }
+}
+
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
@@ -92,6 +153,7 @@ malloc (size_t size)
   struct desc *d;
   struct block *b;
   struct arena *a;
+  size_t class;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -116,39 +178,54 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      big_cnt++;
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  class = d - descs;
+  if (class < MALLOC_CACHE_CLASSES)
     {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL)
+      /* Small block: take it from the running thread's cache,
+         refilling the cache from the descriptor if it is empty. */
+      struct malloc_cache *c = &thread_current ()->malloc_cache;
+      bool hit = c->cnt[class] > 0;
+      enum intr_level old_level;
+
+      ASSERT (!intr_context ());
+      if (!hit)
         {
+          lock_acquire (&d->lock);
+          while (c->cnt[class] < MAGAZINE_BATCH)
+            {
+              b = desc_get_block (d);
+              if (b == NULL)
+                break;
+              list_push_back (&c->blocks[class], &b->free_elem);
+              c->cnt[class]++;
+            }
+          d->refill_cnt++;
           lock_release (&d->lock);
-          return NULL;
+          if (c->cnt[class] == 0)
+            return NULL;
         }
 
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++)
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      b = list_entry (list_pop_front (&c->blocks[class]),
+                      struct block, free_elem);
+      c->cnt[class]--;
+
+      /* Other threads bump these counters without D's lock. */
+      old_level = intr_disable ();
+      d->alloc_cnt++;
+      if (hit)
+        d->hit_cnt++;
+      intr_set_level (old_level);
+      return b;
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  lock_acquire (&d->lock);
+  b = desc_get_block (d);
+  if (b != NULL)
+    d->alloc_cnt++;
   lock_release (&d->lock);
   return b;
 }
@@ -176,7 +253,7 @@ calloc (size_t a, size_t b)
 
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
-block_size (void *block)
+alloc_size (void *block)
 {
   struct block *b = block;
   struct arena *a = block_to_arena (b);
@@ -204,7 +281,7 @@ realloc (void *old_block, size_t new_size)
       void *new_block = malloc (new_size);
       if (old_block != NULL && new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
+          size_t old_size = alloc_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
@@ -233,25 +310,44 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
 
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena)
+          size_t class = d - descs;
+          if (class < MALLOC_CACHE_CLASSES)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++)
+              /* Small block: keep it in the running thread's cache,
+                 draining the oldest blocks to the descriptor when
+                 the cache is full. */
+              struct malloc_cache *c = &thread_current ()->malloc_cache;
+              bool hit = c->cnt[class] < MAGAZINE_SIZE;
+              enum intr_level old_level;
+
+              ASSERT (!intr_context ());
+              list_push_front (&c->blocks[class], &b->free_elem);
+              c->cnt[class]++;
+              if (!hit)
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  lock_acquire (&d->lock);
+                  while (c->cnt[class] > MAGAZINE_SIZE - MAGAZINE_BATCH)
+                    {
+                      struct list_elem *e = list_pop_back (&c->blocks[class]);
+                      desc_put_block (d, list_entry (e, struct block,
+                                                     free_elem));
+                      c->cnt[class]--;
+                    }
+                  d->drain_cnt++;
+                  lock_release (&d->lock);
                 }
-              palloc_free_page (a);
+
+              old_level = intr_disable ();
+              d->freed_cnt++;
+              if (hit)
+                d->hit_cnt++;
+              intr_set_level (old_level);
+              return;
             }
 
+          lock_acquire (&d->lock);
+          desc_put_block (d, b);
+          d->freed_cnt++;
           lock_release (&d->lock);
         }
       else
@@ -263,6 +359,92 @@ free (void *p)
     }
 }
 
+/* Removes and returns a block from descriptor D's free list,
+   creating a new arena if the list is empty.  Returns a null
+   pointer if memory is not available.  D's lock must be held. */
+static struct block *
+desc_get_block (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Get a block from free list. */
+  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  a = block_to_arena (b);
+  a->free_cnt--;
+  return b;
+}
+
+/* Returns block B to descriptor D's free list, giving its arena
+   back to the page allocator if that leaves the arena entirely
+   unused.  D's lock must be held. */
+static void
+desc_put_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena)
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
+/* Prints malloc() statistics. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      if (d->alloc_cnt == 0)
+        continue;
+      printf ("Malloc: %zu-byte blocks: %llu allocs, %llu frees, "
+              "%llu cache hits, %llu refills, %llu drains\n",
+              d->block_size, d->alloc_cnt, d->freed_cnt,
+              d->hit_cnt, d->refill_cnt, d->drain_cnt);
+    }
+  printf ("Malloc: %llu big blocks\n", big_cnt);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
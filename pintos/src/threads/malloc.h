@@ -2,12 +2,31 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <list.h>
 #include <stddef.h>
 
+/* Number of smallest size classes (16 to 256 bytes) that have a
+   per-thread cache. */
+#define MALLOC_CACHE_CLASSES 5
+
+/* Per-thread cache ("magazine") of free blocks for each of the
+   smallest size classes.  A thread allocates from and frees into
+   its own cache without taking the size class's lock, which is
+   only needed to refill or drain the cache in batches. */
+struct malloc_cache
+  {
+    struct list blocks[MALLOC_CACHE_CLASSES];   /* Free blocks. */
+    size_t cnt[MALLOC_CACHE_CLASSES];           /* Blocks in each list. */
+  };
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+void malloc_cache_init (struct malloc_cache *);
+void malloc_cache_drain (struct malloc_cache *);
+void malloc_print_stats (void);
+
 #endif /* threads/malloc.h */
@@ -1,6 +1,7 @@
 #include "threads/palloc.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
 #include <inttypes.h>
 #include <round.h>
 #include <stddef.h>
@@ -23,7 +24,27 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are found in one of two ways.  By
+   default, a first-fit scan of the pool's bitmap of used pages.
+   With the "-palloc=buddy" option, a binary buddy allocator:
+   free pages are kept in blocks of 2**ORDER pages aligned on a
+   2**ORDER page boundary, one free list per order.  A request
+   for PAGE_CNT pages splits the smallest large enough block and
+   returns the pages past PAGE_CNT to the free lists; freeing
+   merges a block with its "buddy" (the other half of the block
+   of the next higher order) for as long as the buddy is free.
+   Both are O(log n) in the size of the pool.  The bitmap is
+   kept up to date either way, to check frees. */
+
+/* Number of buddy orders, so the largest buddy block is
+   2**(BUDDY_ORDERS - 1) pages (128 MB). */
+#define BUDDY_ORDERS 16
+
+/* buddy_order[] value for a page that does not begin a free
+   buddy block. */
+#define BUDDY_NONE 0xff
 
 /* A memory pool. */
 struct pool
@@ -31,14 +52,31 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+
+    /* Buddy allocator, if palloc_buddy. */
+    struct list free_blocks[BUDDY_ORDERS]; /* Free blocks by order. */
+    uint8_t *buddy_order;               /* Order of each free block,
+                                           indexed by first page. */
+  };
+
+/* Free buddy block, stored in the block's first page. */
+struct buddy_block
+  {
+    struct list_elem elem;              /* Element in free_blocks[]. */
   };
 
+/* Use the buddy allocator instead of the bitmap? */
+bool palloc_buddy;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -78,7 +116,14 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (palloc_buddy)
+    {
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx != BITMAP_ERROR)
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+    }
+  else
+    page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -138,7 +183,15 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 #endif
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (palloc_buddy)
+    {
+      lock_acquire (&pool->lock);
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+      buddy_free (pool, page_idx, page_cnt);
+      lock_release (&pool->lock);
+    }
+  else
+    bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +201,27 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the kernel virtual address of the first page of the
+   user pool and stores the number of pages in it in *PAGE_CNT. */
+void *
+palloc_user_pool (size_t *page_cnt)
+{
+  *page_cnt = bitmap_size (user_pool.used_map);
+  return user_pool.base;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map at its base, followed by the
+     buddy allocator's per-page orders if we use it.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t order_size = palloc_buddy ? page_cnt : 0;
+  size_t bm_pages = DIV_ROUND_UP (bm_size + order_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +230,20 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+
+  if (palloc_buddy)
+    {
+      size_t i;
+
+      for (i = 0; i < BUDDY_ORDERS; i++)
+        list_init (&p->free_blocks[i]);
+      p->buddy_order = (uint8_t *) base + bm_size;
+      memset (p->buddy_order, BUDDY_NONE, page_cnt);
+      buddy_free (p, 0, page_cnt);
+    }
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +257,97 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the kernel virtual address of the buddy block that
+   begins at page PAGE_IDX in POOL. */
+static struct buddy_block *
+idx_to_block (struct pool *pool, size_t page_idx)
+{
+  return (struct buddy_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Adds the free block of 2**ORDER pages at PAGE_IDX to POOL,
+   merging it with its buddy as long as the buddy is free. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order)
+{
+  while (order + 1 < BUDDY_ORDERS)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || pool->buddy_order[buddy_idx] != order)
+        break;
+
+      /* Take the buddy off its free list and merge. */
+      list_remove (&idx_to_block (pool, buddy_idx)->elem);
+      pool->buddy_order[buddy_idx] = BUDDY_NONE;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+
+  pool->buddy_order[page_idx] = order;
+  list_push_front (&pool->free_blocks[order],
+                   &idx_to_block (pool, page_idx)->elem);
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL's buddy
+   free lists, as the largest aligned blocks that cover them.
+   POOL's lock must be held, except while initializing POOL. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      while (order + 1 < BUDDY_ORDERS
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      buddy_free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL's buddy free
+   lists and returns the index of the first one, or BITMAP_ERROR
+   if no large enough block is free. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  struct list_elem *e;
+  size_t page_idx;
+  int order, want;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  /* Find the smallest order that fits PAGE_CNT pages, then the
+     smallest free block of at least that order. */
+  for (want = 0; ((size_t) 1 << want) < page_cnt; want++)
+    if (want + 1 >= BUDDY_ORDERS)
+      return BITMAP_ERROR;
+  for (order = want; order < BUDDY_ORDERS; order++)
+    if (!list_empty (&pool->free_blocks[order]))
+      break;
+  if (order >= BUDDY_ORDERS)
+    return BITMAP_ERROR;
+
+  e = list_pop_front (&pool->free_blocks[order]);
+  page_idx = (pg_no (list_entry (e, struct buddy_block, elem))
+              - pg_no (pool->base));
+  pool->buddy_order[page_idx] = BUDDY_NONE;
+
+  /* Split off upper halves until the block is just large
+     enough, then give back the pages past PAGE_CNT. */
+  while (order > want)
+    {
+      order--;
+      buddy_free_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+  if (((size_t) 1 << want) > page_cnt)
+    buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
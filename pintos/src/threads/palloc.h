@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -12,10 +13,16 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* If false (default), allocate pages by scanning a bitmap.
+   If true, use the buddy allocator.
+   Controlled by kernel command-line option "-palloc=buddy". */
+extern bool palloc_buddy;
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void *palloc_user_pool (size_t *page_cnt);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,282 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator.
+
+   Each cache hands out objects of a single, exact size.  Its
+   memory comes from the page allocator one page, called a
+   "slab", at a time.  A slab begins with a struct slab header
+   and is followed by as many objects as fit in the rest of the
+   page, so that objects waste no more than the page's tail
+   instead of up to half of a power-of-2 malloc() block.
+
+   Free objects in a slab are chained through a link word.  If
+   the cache has no constructor, the link overlays the start of
+   the free object.  Otherwise the link is stored just past the
+   object, because a cache with a constructor must return
+   objects in their constructed state: the constructor runs once,
+   when a slab is created, not on every allocation.
+
+   A slab with free objects sits on its cache's partial list;
+   a slab with none sits on the full list.  When a slab becomes
+   entirely free it is given back to the page allocator, unless
+   it is the only slab with free objects. */
+
+/* Cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t slot_size;           /* Object size plus link, aligned. */
+    size_t link_ofs;            /* Offset of link within a slot. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    void (*ctor) (void *);      /* Constructor, or a null pointer. */
+    struct list partial;        /* Slabs with free objects. */
+    struct list full;           /* Slabs without free objects. */
+    size_t free_cnt;            /* Free objects in all slabs. */
+    struct lock lock;           /* Lock. */
+    struct kmem_cache *next;    /* Next cache, for statistics. */
+
+    /* Statistics. */
+    size_t slab_cnt;                /* Slabs currently allocated. */
+    unsigned long long alloc_cnt;   /* Objects allocated. */
+    unsigned long long free_calls;  /* Objects freed. */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in partial or full list. */
+    void *free;                 /* First free object. */
+    size_t in_use;              /* Number of allocated objects. */
+  };
+
+/* Offset of the first object within a slab. */
+#define SLAB_HEADER_SIZE ROUND_UP (sizeof (struct slab), sizeof (void *))
+
+/* All caches, for kmem_print_stats(). */
+static struct kmem_cache *all_caches;
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+
+/* Returns the address of free object OBJ's link word. */
+static inline void **
+obj_link (struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Creates and returns a cache of SIZE-byte objects named NAME.
+   If CTOR is nonnull, it is called once on each object when the
+   object's slab is created, and kmem_cache_free() must be given
+   objects returned to that constructed state.
+   Panics if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, void (*ctor) (void *))
+{
+  struct kmem_cache *c;
+
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("kmem_cache_create: out of memory for cache \"%s\"", name);
+
+  c->name = name;
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor == NULL)
+    {
+      c->link_ofs = 0;
+      c->slot_size = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                               sizeof (void *));
+    }
+  else
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->slot_size = c->link_ofs + sizeof (void *);
+    }
+  c->objs_per_slab = (PGSIZE - SLAB_HEADER_SIZE) / c->slot_size;
+  if (c->objs_per_slab == 0)
+    PANIC ("kmem_cache_create: %zu-byte objects for cache \"%s\" "
+           "do not fit in a slab", size, name);
+  list_init (&c->partial);
+  list_init (&c->full);
+  c->free_cnt = 0;
+  lock_init (&c->lock);
+  c->slab_cnt = 0;
+  c->alloc_cnt = 0;
+  c->free_calls = 0;
+
+  c->next = all_caches;
+  all_caches = c;
+  return c;
+}
+
+/* Allocates and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* If no slab has a free object, create a new slab. */
+  if (list_empty (&c->partial))
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+    }
+
+  /* Take the first free object of the first partial slab. */
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  s->in_use++;
+  c->free_cnt--;
+  if (s->free == NULL)
+    {
+      list_remove (&s->elem);
+      list_push_back (&c->full, &s->elem);
+    }
+  c->alloc_cnt++;
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C.
+   Does nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs.
+     Objects from a cache with a constructor must stay
+     constructed, so leave them alone. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  ASSERT (s->in_use > 0);
+  if (s->free == NULL)
+    {
+      /* The slab was full.  Now it has a free object. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  s->in_use--;
+  c->free_cnt++;
+  c->free_calls++;
+
+  /* If the slab is now entirely unused and another slab has free
+     objects, give this one back to the page allocator. */
+  if (s->in_use == 0 && c->free_cnt >= 2 * c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      c->free_cnt -= c->objs_per_slab;
+      c->slab_cnt--;
+      s->magic = 0;
+      palloc_free_page (s);
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for every slab cache. */
+void
+kmem_print_stats (void)
+{
+  struct kmem_cache *c;
+
+  for (c = all_caches; c != NULL; c = c->next)
+    printf ("Slab: %s: %zu-byte objects, %zu per slab, %zu slabs, "
+            "%llu allocs, %llu frees\n",
+            c->name, c->obj_size, c->objs_per_slab, c->slab_cnt,
+            c->alloc_cnt, c->free_calls);
+}
+
+/* Creates a new slab for cache C, constructs its objects, and
+   adds it to C's partial list.  Returns the new slab, or a null
+   pointer if memory is not available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free = NULL;
+  s->in_use = 0;
+
+  /* Chain the objects in address order. */
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + SLAB_HEADER_SIZE + i * c->slot_size;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+
+  list_push_front (&c->partial, &s->elem);
+  c->free_cnt += c->objs_per_slab;
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that object OBJ from cache C is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and belongs to C. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT (pg_ofs (obj) >= SLAB_HEADER_SIZE);
+  ASSERT ((pg_ofs (obj) - SLAB_HEADER_SIZE) % c->slot_size == 0);
+
+  return s;
+}
@@ -43,13 +43,35 @@
 
 #define READY_LIST_LEN (PRI_MAX - PRI_MIN + 1)
 /* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
+   that are ready to run but not actually running.  There is one
+   FIFO per priority level, so enqueue and dequeue are O(1). */
 static struct list ready_list[READY_LIST_LEN];
-#define READY_LIST_END (ready_list + READY_LIST_LEN)
+
+/* Occupancy mask of ready_list: bit I is set if and only if
+   ready_list[I] is nonempty.  The highest set bit is the
+   priority level of the next thread to run. */
+static uint64_t ready_mask;
 
 /* The system-wild load average. */
 static int load_average = 0;
 
+/* Lazy recent_cpu decay for the advanced scheduler.
+
+   Once per second every thread's recent_cpu must be multiplied by
+   a decay coefficient that depends on the load average at that
+   moment.  Rather than walking all_list with interrupts off, we
+   record each second's coefficient in a ring and let a thread
+   catch up on the seconds it missed when it is next touched
+   (see mlfqs_catch_up()).  Only the running and ready threads are
+   caught up at the second boundary; a cursor also sweeps a few
+   threads of all_list per tick so that no blocked thread falls
+   more than DECAY_HISTORY seconds behind. */
+#define DECAY_HISTORY 64                /* Seconds of coefficients kept. */
+#define SWEEP_PER_TICK 2                /* Threads swept per tick. */
+static int decay_history[DECAY_HISTORY];
+static int mlfqs_epoch;                 /* Seconds since boot. */
+static struct list_elem *sweep_cursor;  /* Next all_list thread to sweep. */
+
 /* The # of ready threads, except idle thread.
    This value is initialized after idle thread is started. */
 static int ready_threads;
@@ -100,20 +122,12 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
-static bool thread_larger_func(const struct list_elem *a, const struct list_elem *b, void *aux);
-
-/*compare the two thread */
-bool thread_larger_func(const struct list_elem *a,
-                   const struct list_elem *b, void *aux UNUSED)
-{
-    struct thread *sa, *sb;
-
-    sa = list_entry(a, struct thread, elem);
-    sb = list_entry(b, struct thread, elem);
-
-    /* compare the address of the two block */
-    return sa->priority > sb->priority;
-}
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *, int priority);
+static int ready_max_priority (void);
+static void mlfqs_catch_up (struct thread *);
+static void mlfqs_second (void);
+static void mlfqs_sweep (void);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -131,16 +145,14 @@ bool thread_larger_func(const struct list_elem *a,
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  if (thread_mlfqs){
-    struct list* lp = ready_list;
-    while (lp < READY_LIST_END)
-    list_init (lp++);
-  }
-  else
-    list_init (ready_list);
+  for (i = 0; i < READY_LIST_LEN; i++)
+    list_init (&ready_list[i]);
+  ready_mask = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -184,25 +196,12 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  t->recent_cpu += 1<< FP_LOC;
-
-  if (timer_ticks() % TIMER_FREQ == 0){
-	  struct list_elem* i;
-	  int64_t a;
-
-
-	  /* Update load_average. */
-	  load_average = load_average * 59 / 60 + (ready_threads << FP_LOC) / 60;
-
-	  /* update recent_cpu. */
-	  a = (((int64_t)load_average) << (1 + FP_LOC)) / ((load_average << 1)+ (1 << FP_LOC));
-	  for (i = list_begin(&all_list); i != list_end(&all_list); i = list_next(i)){
-		  struct thread* tp = list_entry(i, struct thread, allelem);
-		  tp->recent_cpu = ((a * tp->recent_cpu) >> FP_LOC) + tp->nice;
-		  refresh_priority(tp);
-	  }
-
+  if (thread_mlfqs){
+	  t->recent_cpu += 1<< FP_LOC;
 
+	  if (timer_ticks() % TIMER_FREQ == 0)
+		  mlfqs_second();
+	  mlfqs_sweep();
   }
 
   /* Enforce preemption. */
@@ -256,7 +255,12 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  old_level = intr_disable ();
+  if (thread_mlfqs)
+    mlfqs_catch_up (thread_current ());
   t->recent_cpu = thread_current()->recent_cpu;
+  t->recent_cpu_epoch = mlfqs_epoch;
+  intr_set_level (old_level);
 #ifdef VM
   page_table_init (&t->page_table);
 #endif
@@ -330,11 +334,11 @@ thread_unblock (struct thread *t)
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
 
+  /* Priority of a thread that slept through a second boundary is
+     stale; bring it up to date before choosing its queue. */
   if (thread_mlfqs)
-	  list_push_back (ready_list + t->priority - PRI_MIN, &t->elem);
-  else
-	  list_insert_ordered (ready_list, &t->elem,
-                     thread_larger_func, NULL);
+    refresh_priority (t);
+  ready_push (t);
   t->status = THREAD_READY;
   if (t != idle_thread)
 	++ready_threads;
@@ -390,10 +394,15 @@ thread_exit (void)
   process_exit ();
 #endif
 
+  /* Give our cached malloc() blocks back to other threads. */
+  malloc_cache_drain (&thread_current ()->malloc_cache);
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  if (sweep_cursor == &thread_current ()->allelem)
+    sweep_cursor = list_next (sweep_cursor);
   list_remove (&thread_current()->allelem);
   --ready_threads;
   thread_current ()->status = THREAD_DYING;
@@ -412,13 +421,8 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    if (thread_mlfqs)
-      list_push_back (ready_list + cur->priority - PRI_MIN, &cur->elem);
-    else
-      list_insert_ordered (ready_list, &cur->elem,
-                           thread_larger_func, NULL);
-  }
+  if (cur != idle_thread)
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -471,8 +475,10 @@ thread_set_priority (int new_priority)
 */
 void
 refresh_priority(struct thread* t){
-	if (thread_mlfqs && t != idle_thread){
+	int old_priority = t->priority;
 
+	if (thread_mlfqs && t != idle_thread){
+		mlfqs_catch_up(t);
 		t->priority = ((PRI_MAX << FP_LOC) - (t->recent_cpu >> 2) - (t->nice << 1)) >> FP_LOC;
 		if (t->priority > PRI_MAX)
 			t->priority = PRI_MAX;
@@ -484,17 +490,21 @@ refresh_priority(struct thread* t){
 
 		t->priority = t->original_priority;
 
-		if (list_empty(&t->waiting_thread_list)) {
-			return;
-		}
-
-		high_priority_thread = list_entry(list_front(&t->waiting_thread_list),
-		struct thread, waiting_list_elem);
+		if (!list_empty(&t->waiting_thread_list)) {
+			high_priority_thread = list_entry(list_front(&t->waiting_thread_list),
+			struct thread, waiting_list_elem);
 
-		if ((high_priority_thread->priority) > (t->priority)) {
-			t->priority = high_priority_thread->priority;
+			if ((high_priority_thread->priority) > (t->priority)) {
+				t->priority = high_priority_thread->priority;
+			}
 		}
 	}
+
+	/* A ready thread must move to the queue of its new priority. */
+	if (t->status == THREAD_READY && t->priority != old_priority) {
+		ready_remove(t, old_priority);
+		ready_push(t);
+	}
 }
 
 
@@ -516,7 +526,13 @@ void donate_priority(void) {
       return;
     }
 
-    lock->holder->priority = thread->priority;
+    if (lock->holder->status == THREAD_READY) {
+      ready_remove (lock->holder, lock->holder->priority);
+      lock->holder->priority = thread->priority;
+      ready_push (lock->holder);
+    } else {
+      lock->holder->priority = thread->priority;
+    }
     thread = lock->holder;
     lock = thread->wait_on_lock;
   }
@@ -580,7 +596,81 @@ thread_get_load_avg (void)
 int
 thread_get_recent_cpu (void)
 {
-	return (thread_current()->recent_cpu * 100) >> FP_LOC;
+	enum intr_level old_level = intr_disable();
+	int recent_cpu;
+
+	mlfqs_catch_up(thread_current());
+	recent_cpu = thread_current()->recent_cpu;
+	intr_set_level(old_level);
+	return (recent_cpu * 100) >> FP_LOC;
+}
+
+/* Applies to T the recent_cpu decay of every second that has
+   passed since T was last brought up to date. */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+	enum intr_level old_level = intr_disable();
+
+	/* Coefficients older than the ring are gone.  The sweep keeps
+	   this from happening, but if it does, decay from the oldest
+	   coefficient we still have. */
+	if (mlfqs_epoch - t->recent_cpu_epoch > DECAY_HISTORY)
+		t->recent_cpu_epoch = mlfqs_epoch - DECAY_HISTORY;
+
+	while (t->recent_cpu_epoch < mlfqs_epoch) {
+		int64_t a = decay_history[++t->recent_cpu_epoch % DECAY_HISTORY];
+		t->recent_cpu = ((a * t->recent_cpu) >> FP_LOC) + t->nice;
+	}
+	intr_set_level(old_level);
+}
+
+/* Once-per-second bookkeeping of the advanced scheduler: updates
+   load_average, records this second's decay coefficient and
+   recomputes the priority of the runnable threads.  Blocked
+   threads are caught up lazily. */
+static void
+mlfqs_second (void)
+{
+	struct thread *cur = running_thread ();
+	int64_t a;
+	int i;
+
+	/* Update load_average. */
+	load_average = load_average * 59 / 60 + (ready_threads << FP_LOC) / 60;
+
+	/* Record the recent_cpu decay coefficient of this second. */
+	a = (((int64_t)load_average) << (1 + FP_LOC)) / ((load_average << 1)+ (1 << FP_LOC));
+	mlfqs_epoch++;
+	decay_history[mlfqs_epoch % DECAY_HISTORY] = a;
+
+	refresh_priority(cur);
+	for (i = 0; i < READY_LIST_LEN; i++) {
+		struct list_elem *e = list_begin(&ready_list[i]);
+		while (e != list_end(&ready_list[i])) {
+			struct list_elem *next = list_next(e);
+			refresh_priority(list_entry(e, struct thread, elem));
+			e = next;
+		}
+	}
+}
+
+/* Catches up the next SWEEP_PER_TICK threads of all_list, so
+   that threads blocked for a long time never fall behind the
+   decay history. */
+static void
+mlfqs_sweep (void)
+{
+	int i;
+
+	for (i = 0; i < SWEEP_PER_TICK; i++) {
+		if (sweep_cursor == NULL || sweep_cursor == list_end(&all_list))
+			sweep_cursor = list_begin(&all_list);
+		if (sweep_cursor == list_end(&all_list))
+			return;
+		mlfqs_catch_up(list_entry(sweep_cursor, struct thread, allelem));
+		sweep_cursor = list_next(sweep_cursor);
+	}
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -618,6 +708,7 @@ idle (void *idle_started_ UNUSED)
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
+      timer_idle_enter ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -673,7 +764,9 @@ init_thread (struct thread *t, const char *name, int priority)
   t->original_priority = priority;
   t->nice = 0;
   t->recent_cpu = 0;
+  t->recent_cpu_epoch = mlfqs_epoch;
   t->sleep_end_tick = 0;
+  malloc_cache_init (&t->malloc_cache);
 #ifdef USERPROG
   list_init(&t->children);
   lock_init(&t->children_lock);
@@ -685,6 +778,7 @@ init_thread (struct thread *t, const char *name, int priority)
 #ifdef VM
   list_init(&t->mmap_list);
   t->mapid = 0;
+  t->swap_next = BITMAP_ERROR;
 #endif
   t->magic = THREAD_MAGIC;
 
@@ -717,15 +811,62 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-	if (thread_mlfqs){
-		struct list* lp = READY_LIST_END;
-		while (--lp >= ready_list)
-			if (!list_empty(lp))
-				return list_entry(list_pop_front(lp), struct thread, elem);
+  int priority = ready_max_priority ();
+  struct thread *t;
+
+  if (priority < PRI_MIN)
+    return idle_thread;
+
+  t = list_entry (list_pop_front (&ready_list[priority - PRI_MIN]),
+                  struct thread, elem);
+  if (list_empty (&ready_list[priority - PRI_MIN]))
+    ready_mask &= ~((uint64_t) 1 << (priority - PRI_MIN));
+  return t;
+}
+
+/* Appends T to the run queue of its current priority.
+   Must be called with interrupts off. */
+static void
+ready_push (struct thread *t)
+{
+  int idx = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
 
-	} else if (!list_empty (ready_list))
-	    return list_entry (list_pop_front (ready_list), struct thread, elem);
-	return idle_thread;
+  list_push_back (&ready_list[idx], &t->elem);
+  ready_mask |= (uint64_t) 1 << idx;
+}
+
+/* Removes T from the run queue of PRIORITY, which must be the
+   queue T was pushed on.  Must be called with interrupts off. */
+static void
+ready_remove (struct thread *t, int priority)
+{
+  int idx = priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_list[idx]))
+    ready_mask &= ~((uint64_t) 1 << idx);
+}
+
+/* Returns the highest priority among ready threads, or
+   PRI_MIN - 1 if no thread is ready.  Finds the most significant
+   set bit of ready_mask, one 32-bit half at a time. */
+static int
+ready_max_priority (void)
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  if (high != 0)
+    return PRI_MIN + 63 - __builtin_clz (high);
+  else if (low != 0)
+    return PRI_MIN + 31 - __builtin_clz (low);
+  else
+    return PRI_MIN - 1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -813,25 +954,15 @@ allocate_tid (void)
 
 /*test and yield the thread*/
 void test_yield(void) {
-	if (thread_mlfqs){
-		struct list* pl = READY_LIST_END;
-		while (--pl - ready_list > thread_current()->priority - PRI_MIN)
-			if (!list_empty(pl))
-				thread_yield();
-	}
-	else{
-		struct thread *t;
-
-		if (list_empty(ready_list)) {
-			return;
-		}
-
-		t = list_entry(list_front(ready_list),
-		struct thread, elem);
-
-		if ((thread_current()->priority) < t->priority) {
+	enum intr_level old_level = intr_disable();
+	bool should_yield = ready_max_priority() > thread_current()->priority;
+	intr_set_level(old_level);
+
+	if (should_yield) {
+		if (intr_context())
+			intr_yield_on_return();
+		else
 			thread_yield();
-		}
 	}
 }
 
@@ -16,6 +16,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#include "threads/malloc.h"
 #include "filesys/file.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -107,6 +108,7 @@ struct thread
     int original_priority;              /* Original Priority */
     int nice;                           /* Nice value for advanced scheduler. */
     int recent_cpu;                     /* recent_cpu for advanced scheduler. */
+    int recent_cpu_epoch;               /* Last second decayed into recent_cpu. */
 
     struct list_elem allelem;           /* List element for all threads list. */
 
@@ -133,6 +135,9 @@ struct thread
     struct hash page_table;
     struct list mmap_list;
     int mapid;
+    size_t swap_next;                   /* Next swap slot for our pages. */
+    void *fault_next;                   /* Page a sequential fault hits. */
+    size_t fault_window;                /* Pages to load on that fault. */
 #endif
 
     /* Owned by devices/timer.c. */
@@ -142,6 +147,9 @@ struct thread
     struct list waiting_thread_list;    /* Thread list waiting for the lock acquired by current thread */
     struct list_elem waiting_list_elem;  /* list elem for waiting thread list */
 
+    /* Owned by threads/malloc.c. */
+    struct malloc_cache malloc_cache;   /* Free small blocks. */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
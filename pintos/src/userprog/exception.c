@@ -155,8 +155,9 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  // only if it's a missing and by user, it should try to fixed.
-  if (not_present && user && page_find_and_load (fault_addr, f->esp, write)) {
+  // only if it's a missing page, or a write to the shared zero page,
+  // and by user, it should try to fixed.
+  if ((not_present || write) && user && page_find_and_load (fault_addr, f->esp, write)) {
     return; // success fix the problem
   }
 
@@ -17,6 +17,7 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -159,6 +160,89 @@ start_process (void *arg_)
   NOT_REACHED ();
 }
 
+struct process_fork_arg{
+  struct thread* parent;
+  const struct intr_frame *if_;
+  struct semaphore sema_relation;
+  bool success;
+};
+
+static thread_func start_fork NO_RETURN;
+
+/* Starts a new process that is a copy of the running one, with
+   the same memory, open files and registers, except that it
+   returns 0 from the fork system call that IF_ was saved by.
+   Its memory is shared copy-on-write with ours.  Returns the new
+   process's thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct process_fork_arg arg;
+  tid_t tid;
+
+  arg.parent = thread_current ();
+  arg.if_ = if_;
+  sema_init (&arg.sema_relation, 0);
+  arg.success = false;
+
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, &arg);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  sema_down (&arg.sema_relation);
+  if (arg.success)
+    return tid;
+  process_wait (tid);
+  return TID_ERROR;
+}
+
+/* A thread function that makes the running thread a copy of the
+   process that called process_fork() and starts it running. */
+static void
+start_fork (void *arg_)
+{
+  struct process_fork_arg *arg = arg_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = *arg->if_;
+  bool success = false;
+
+  // build relationship
+  t->parent = arg->parent;
+  lock_acquire(&t->parent->children_lock);
+  list_push_back(&t->parent->children, &t->child_elem);
+  lock_release(&t->parent->children_lock);
+
+  /* Copy the address space.  The parent waits until we're done,
+     so its page table and files hold still. */
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      t->file = file_reopen (t->parent->file);
+      if (t->file != NULL)
+        {
+          file_deny_write (t->file);
+          success = (process_clone_files (t->parent)
+                     && page_table_clone (t->parent));
+        }
+    }
+
+  arg->success = success;
+  sema_up (&arg->sema_relation);
+  if (!success)
+    {
+      lock_acquire (&filesys_lock);
+      process_close_file (CLOSE_ALL);
+      lock_release (&filesys_lock);
+      thread_exit ();
+    }
+
+  /* The child sees fork() return 0. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -530,7 +614,7 @@ static bool
 setup_stack (void **esp)
 {
   void *init_esp = ((uint8_t *) PHYS_BASE) - PGSIZE;
-  if (grow_stack (init_esp)) {
+  if (grow_stack (init_esp, true)) {
     *esp = PHYS_BASE;
     return true;
   } else {
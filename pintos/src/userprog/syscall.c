@@ -3,7 +3,7 @@
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
@@ -26,6 +26,8 @@ struct process_mmap_record {
     struct list_elem elem;
 };
 
+static struct kmem_cache *file_record_cache;
+static struct kmem_cache *mmap_record_cache;
 
 void *current_esp = NULL;
 
@@ -56,9 +58,11 @@ int process_add_file (struct file *f);
 void process_close_file (int fd);
 bool process_add_mmap (struct SP_entry *page_entry);
 void process_remove_mmap (int mapping);
+void process_sync_mmap (int mapping);
 
 int mmap (int fd, void *addr);
 void munmap (int mapping);
+void msync (int mapping);
 
 static void syscall_exit (int rcode);
 
@@ -245,7 +249,7 @@ close (int fd)
 int
 process_add_file (struct file *f)
 {
-    struct process_file_record *pf = malloc (sizeof (struct process_file_record));
+    struct process_file_record *pf = kmem_cache_alloc (file_record_cache);
     pf->file = f;
     pf->fd = thread_current ()->fd;
     thread_current ()->fd++;
@@ -253,6 +257,40 @@ process_add_file (struct file *f)
     return pf->fd;
 }
 
+// Gives the running thread, a child made by fork(), its own handle
+// on each file PARENT has open, under the same descriptor and at the
+// same position.
+bool
+process_clone_files (struct thread *parent)
+{
+    struct thread *t = thread_current ();
+    struct list_elem *e;
+    bool success = true;
+
+    lock_acquire (&filesys_lock);
+    for (e = list_begin (&parent->file_list); e != list_end (&parent->file_list);
+         e = list_next (e)) {
+        struct process_file_record *parent_pf = list_entry (e, struct process_file_record, elem);
+        struct process_file_record *pf = kmem_cache_alloc (file_record_cache);
+        if (!pf) {
+            success = false;
+            break;
+        }
+        pf->file = file_reopen (parent_pf->file);
+        if (!pf->file) {
+            kmem_cache_free (file_record_cache, pf);
+            success = false;
+            break;
+        }
+        file_seek (pf->file, file_tell (parent_pf->file));
+        pf->fd = parent_pf->fd;
+        list_push_back (&t->file_list, &pf->elem);
+    }
+    t->fd = parent->fd;
+    lock_release (&filesys_lock);
+    return success;
+}
+
 struct file *
 process_get_file (int fd)
 {
@@ -280,7 +318,7 @@ process_close_file (int fd)
         if (fd == pf->fd || fd == CLOSE_ALL) {
             file_close (pf->file);
             list_remove (&pf->elem);
-            free (pf);
+            kmem_cache_free (file_record_cache, pf);
             if (fd != CLOSE_ALL) {
                 return;
             }
@@ -335,6 +373,11 @@ void munmap (int mapping)
     process_remove_mmap (mapping);
 }
 
+void msync (int mapping)
+{
+    process_sync_mmap (mapping);
+}
+
 //
 //                                              ,,    ,,
 //     `7MMF'  `7MMF'                         `7MM  `7MM
@@ -361,7 +404,8 @@ syscall_exit (int rcode){
     thread_exit ();
 }
 
-static int arg_count[] = {0, 1, 1, 1, 2, 1, 1, 1, 3, 3, 2, 1, 1, 2, 1};
+static int arg_count[] = {0, 1, 1, 1, 2, 1, 1, 1, 3, 3, 2, 1, 1, 2, 1,
+                          1, 1, 2, 1, 1, 0, 1};
 static void
 syscall_handler (struct intr_frame *f)
 {
@@ -370,7 +414,9 @@ syscall_handler (struct intr_frame *f)
     void **p = f->esp; // parameters are a array of anything
     check_valid_pointer (p, false); // check the first parameter pointer
     int event_id = (int)p[0];
-    ASSERT (event_id <= 14 && "We only support syscall from 0 to 14.");
+    if (event_id < 0 || event_id > SYS_MSYNC) {
+        syscall_exit (ERROR);
+    }
     check_valid_pointer (p + arg_count[event_id], false); // check the last
 
     switch (event_id) {
@@ -440,6 +486,14 @@ syscall_handler (struct intr_frame *f)
             munmap ((int)p[1]);
             break;
         }
+        case SYS_FORK: { // 20
+            f->eax = process_fork (f);
+            break;
+        }
+        case SYS_MSYNC: { // 21, mapid
+            msync ((int)p[1]);
+            break;
+        }
         default: {
             printf ("Oops\n");
             thread_exit ();
@@ -463,13 +517,17 @@ void
 syscall_init (void)
 {
     lock_init (&filesys_lock);
+    file_record_cache = kmem_cache_create ("process_file_record",
+                                           sizeof (struct process_file_record), NULL);
+    mmap_record_cache = kmem_cache_create ("process_mmap_record",
+                                           sizeof (struct process_mmap_record), NULL);
     intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 bool
 process_add_mmap (struct SP_entry *page_entry)
 {
-    struct process_mmap_record *mm = malloc (sizeof (struct process_mmap_record));
+    struct process_mmap_record *mm = kmem_cache_alloc (mmap_record_cache);
     if (!mm) {
         return false;
     }
@@ -479,6 +537,38 @@ process_add_mmap (struct SP_entry *page_entry)
     return true;
 }
 
+// Writes PAGE_ENTRY back to its file if it's dirty, after waiting
+// for any write the writeback thread has in flight.  The caller pins
+// PAGE_ENTRY so that it stays put.
+static void
+mmap_flush_page (struct thread *t, struct SP_entry *page_entry)
+{
+    frame_wait_io (page_entry);
+    if (page_entry->is_loaded && pagedir_is_dirty (t->pagedir, page_entry->page)) {
+        pagedir_set_dirty (t->pagedir, page_entry->page, false);
+        lock_acquire (&filesys_lock);
+        file_write_at (page_entry->file, page_entry->page,
+                       page_entry->read_bytes, page_entry->offset);
+        lock_release (&filesys_lock);
+    }
+}
+
+void
+process_sync_mmap (int mapping)
+{
+    struct thread *t = thread_current ();
+    struct list_elem *e;
+
+    for (e = list_begin (&t->mmap_list); e != list_end (&t->mmap_list); e = list_next (e)) {
+        struct process_mmap_record *mm = list_entry (e, struct process_mmap_record, elem);
+        if (mm->mapid == mapping) {
+            mm->page_entry->pinned = true;
+            mmap_flush_page (t, mm->page_entry);
+            mm->page_entry->pinned = false;
+        }
+    }
+}
+
 void
 process_remove_mmap (int mapping)
 {
@@ -492,13 +582,8 @@ process_remove_mmap (int mapping)
         struct process_mmap_record *mm = list_entry (e, struct process_mmap_record, elem);
         if (mm->mapid == mapping || mapping == CLOSE_ALL) {
             mm->page_entry->pinned = true;
+            mmap_flush_page (t, mm->page_entry);
             if (mm->page_entry->is_loaded) {
-                if (pagedir_is_dirty (t->pagedir, mm->page_entry->page)) {
-                    lock_acquire (&filesys_lock);
-                    file_write_at (mm->page_entry->file, mm->page_entry->page,
-                                   mm->page_entry->read_bytes, mm->page_entry->offset);
-                    lock_release (&filesys_lock);
-                }
                 frame_free (pagedir_get_page (t->pagedir, mm->page_entry->page));
                 pagedir_clear_page (t->pagedir, mm->page_entry->page);
             }
@@ -515,8 +600,8 @@ process_remove_mmap (int mapping)
                 close = mm->mapid;
                 f = mm->page_entry->file;
             }
-            free (mm->page_entry);
-            free (mm);
+            page_entry_free (mm->page_entry);
+            kmem_cache_free (mmap_record_cache, mm);
         }
         e = next;
     }
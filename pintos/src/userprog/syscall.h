@@ -10,7 +10,10 @@
 struct lock filesys_lock;
 
 void syscall_init (void);
+bool process_clone_files (struct thread *parent);
+void process_close_file (int fd);
 bool process_add_mmap (struct SP_entry *page_entry);
 void process_remove_mmap (int mapping);
+void process_sync_mmap (int mapping);
 
 #endif /* userprog/syscall.h */
@@ -1,8 +1,13 @@
 #include "vm/frame.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
 #include "filesys/file.h"
-#include "threads/malloc.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "vm/swap.h"
@@ -10,6 +15,76 @@
 struct lock frame_table_lock;
 struct list frame_table;
 
+// Signaled when a page finishes being written out by frame_evict().
+static struct condition frame_io_done;
+
+// Frames held by the frame table, including frames being evicted.
+static size_t frame_used_cnt;
+
+// The pageout thread evicts frames in the background once fewer than
+// pageout_low frames are free, until pageout_high frames are free, so
+// that page faults normally find a free frame without evicting.
+static size_t pageout_low, pageout_high;
+static struct semaphore pageout_wake;
+static bool pageout_running;
+
+// If true, select victims with the two-handed clock instead of the
+// one-handed second-chance clock.  Set by the kernel command-line
+// option "-clock=two-handed".
+bool frame_two_handed;
+
+// Clock hands, kept across calls so that each eviction resumes where
+// the last one stopped.  clock_hand is the one-handed clock's hand and
+// the two-handed clock's front hand, which clears accessed bits;
+// evict_hand trails it by about hand_spread frames and evicts pages
+// that haven't been accessed since the front hand passed.  A hand may
+// point at list_end(&frame_table), meaning the list's beginning.
+static struct list_elem *clock_hand;
+static struct list_elem *evict_hand;
+static size_t hand_spread;
+
+// Statistics.
+static unsigned long long pageout_evict_cnt;   // Evicted by pageout
+static unsigned long long direct_evict_cnt;    // Evicted by frame_alloc
+static unsigned long long frame_fault_cnt;     // Frames handed to faults
+static unsigned long long hand_travel_cnt;     // Frames passed by hands
+static unsigned long long select_cnt;          // Victims selected
+static unsigned long long clean_evict_cnt;     // Already in swap, no I/O
+static unsigned long long swap_reclaim_cnt;    // Slots dropped, swap full
+static unsigned long long swap_full_cnt;       // Faults failed, swap full
+static unsigned long long text_share_cnt;      // Text pages found cached
+static unsigned long long text_unmap_cnt;      // Sharers' mappings evicted
+static unsigned long long writeback_cnt;       // Written by writeback
+static unsigned long long cow_evict_cnt;       // Sharers moved to swap
+
+static void pageout (void *aux);
+
+// The writeback thread writes dirty mmap pages back to their files in
+// the background, up to WRITEBACK_BATCH at a time.
+#define WRITEBACK_INTERVAL 500
+#define WRITEBACK_BATCH 16
+static void writeback (void *aux);
+static void frame_unlink (struct frame_entry *);
+
+// In-use frames holding read-only file pages, keyed by inode, offset
+// and length.
+static struct hash text_cache;
+
+// Frame metadata for the whole user pool, indexed by frame number.
+static struct frame_entry *frame_map;
+static uint8_t *frame_base;
+static size_t frame_cnt;
+
+// Returns the entry for FRAME, a page in the user pool.
+static struct frame_entry *
+frame_to_entry (const void *frame)
+{
+    size_t idx = pg_no (frame) - pg_no (frame_base);
+    ASSERT (pg_ofs (frame) == 0);
+    ASSERT (idx < frame_cnt);
+    return &frame_map[idx];
+}
+
 //
 //                            ,,        ,,    ,,
 //     `7MM"""Mq.            *MM      `7MM    db
@@ -22,11 +97,195 @@ struct list frame_table;
 //
 //
 
+static unsigned
+text_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+    struct frame_entry *frame_entry = hash_entry (e, struct frame_entry, text_elem);
+    return (hash_int ((int) frame_entry->inode)
+            ^ hash_int (frame_entry->offset + frame_entry->read_bytes));
+}
+
+static bool
+text_less_func (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    struct frame_entry *a = hash_entry (a_, struct frame_entry, text_elem);
+    struct frame_entry *b = hash_entry (b_, struct frame_entry, text_elem);
+    if (a->inode != b->inode) {
+        return a->inode < b->inode;
+    }
+    if (a->offset != b->offset) {
+        return a->offset < b->offset;
+    }
+    return a->read_bytes < b->read_bytes;
+}
+
+// Takes FRAME_ENTRY out of the text cache, if it's there.
+// frame_table_lock must be held.
+static void
+frame_text_remove (struct frame_entry *frame_entry)
+{
+    if (frame_entry->inode) {
+        hash_delete (&text_cache, &frame_entry->text_elem);
+        frame_entry->inode = NULL;
+    }
+}
+
 void
 frame_table_init (void)
 {
     list_init (&frame_table);
     lock_init (&frame_table_lock);
+    hash_init (&text_cache, text_hash_func, text_less_func, NULL);
+    cond_init (&frame_io_done);
+
+    frame_base = palloc_user_pool (&frame_cnt);
+    size_t map_pages = DIV_ROUND_UP (frame_cnt * sizeof *frame_map, PGSIZE);
+    frame_map = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, map_pages);
+    size_t i;
+    for (i = 0; i < frame_cnt; i++) {
+        frame_map[i].frame = frame_base + i * PGSIZE;
+        list_init (&frame_map[i].sharers);
+    }
+
+    hand_spread = frame_cnt / 4 > 1 ? frame_cnt / 4 : 1;
+    clock_hand = evict_hand = list_end (&frame_table);
+
+    pageout_low = frame_cnt / 32 > 2 ? frame_cnt / 32 : 2;
+    pageout_high = 2 * pageout_low;
+    sema_init (&pageout_wake, 0);
+}
+
+// Starts the pageout and writeback threads.  Needs swap, so it's
+// called after swap_init().
+void
+frame_pageout_start (void)
+{
+    pageout_running = true;
+    if (thread_create ("pageout", PRI_DEFAULT, pageout, NULL) == TID_ERROR) {
+        PANIC ("Can't create pageout thread.");
+    }
+    if (thread_create ("writeback", PRI_DEFAULT, writeback, NULL) == TID_ERROR) {
+        PANIC ("Can't create writeback thread.");
+    }
+}
+
+// Returns the number of free frames in the user pool.
+static size_t
+frame_free_cnt (void)
+{
+    return frame_cnt - frame_used_cnt;
+}
+
+// Returns true if frames are plentiful enough to spend some on pages
+// that haven't been asked for yet.
+bool
+frame_has_spare (void)
+{
+    return frame_free_cnt () > pageout_high;
+}
+
+// Evicts frames until pageout_high frames are free, each time the
+// free count drops below pageout_low.
+static void
+pageout (void *aux UNUSED)
+{
+    for (;;) {
+        pageout_running = false;
+        sema_down (&pageout_wake);
+        while (frame_free_cnt () < pageout_high) {
+            void *frame = frame_evict (0, NULL);
+            if (!frame) {
+                break;
+            }
+            pageout_evict_cnt++;
+            palloc_free_page (frame);
+        }
+    }
+}
+
+// Starts writing back up to WRITEBACK_BATCH dirty mmap pages, marked
+// in transit so that munmap() and eviction wait for them, and returns
+// how many were written.
+static size_t
+writeback_batch (void)
+{
+    struct SP_entry *batch[WRITEBACK_BATCH];
+    void *frames[WRITEBACK_BATCH];
+    size_t cnt = 0, i;
+    struct list_elem *e;
+
+    lock_acquire (&frame_table_lock);
+    for (e = list_begin (&frame_table);
+         e != list_end (&frame_table) && cnt < WRITEBACK_BATCH; e = list_next (e)) {
+        struct frame_entry *frame_entry = list_entry (e, struct frame_entry, elem);
+        struct SP_entry *page_entry = frame_entry->page_entry;
+        uint32_t *pd = frame_entry->thread->pagedir;
+        if (page_entry->type != SP_MMAP || page_entry->pinned || page_entry->in_transit) {
+            continue;
+        }
+
+        // Writes after this point dirty the page again.
+        enum intr_level old_level = intr_disable ();
+        bool dirty = pagedir_is_dirty (pd, page_entry->page);
+        pagedir_set_dirty (pd, page_entry->page, false);
+        intr_set_level (old_level);
+        if (dirty) {
+            page_entry->in_transit = true;
+            batch[cnt] = page_entry;
+            frames[cnt++] = frame_entry->frame;
+        }
+    }
+    lock_release (&frame_table_lock);
+    if (cnt == 0) {
+        return 0;
+    }
+
+    lock_acquire (&filesys_lock);
+    for (i = 0; i < cnt; i++) {
+        file_write_at (batch[i]->file, frames[i], batch[i]->read_bytes, batch[i]->offset);
+    }
+    lock_release (&filesys_lock);
+
+    lock_acquire (&frame_table_lock);
+    for (i = 0; i < cnt; i++) {
+        batch[i]->in_transit = false;
+    }
+    cond_broadcast (&frame_io_done, &frame_table_lock);
+    writeback_cnt += cnt;
+    lock_release (&frame_table_lock);
+    return cnt;
+}
+
+// Every WRITEBACK_INTERVAL milliseconds, writes back all dirty mmap
+// pages, so that little is left to write when they're unmapped or
+// their process exits.
+static void
+writeback (void *aux UNUSED)
+{
+    for (;;) {
+        timer_msleep (WRITEBACK_INTERVAL);
+        while (writeback_batch () == WRITEBACK_BATCH) {
+            continue;
+        }
+    }
+}
+
+void
+frame_print_stats (void)
+{
+    printf ("Frames: %llu evicted by pageout, %llu evicted on fault\n",
+            pageout_evict_cnt, direct_evict_cnt);
+    printf ("Clock: %s, %llu frame faults, %llu evictions per 1000 faults, "
+            "%llu frames of hand travel per eviction\n",
+            frame_two_handed ? "two-handed" : "one-handed", frame_fault_cnt,
+            frame_fault_cnt ? select_cnt * 1000 / frame_fault_cnt : 0,
+            select_cnt ? hand_travel_cnt / select_cnt : 0);
+    printf ("Frames: %llu clean evictions from swap cache, "
+            "%llu swap slots reclaimed, %llu allocations failed for swap\n",
+            clean_evict_cnt, swap_reclaim_cnt, swap_full_cnt);
+    printf ("Frames: %llu text pages shared, %llu shared mappings evicted, "
+            "%llu shared mappings swapped, %llu mmap pages written back\n",
+            text_share_cnt, text_unmap_cnt, cow_evict_cnt, writeback_cnt);
 }
 
 void *
@@ -36,16 +295,26 @@ frame_alloc (enum palloc_flags flags, struct SP_entry *page_entry)
         return NULL;
     }
     void *frame = palloc_get_page (flags);
-    if (frame) {
-        frame_add (frame, page_entry);
-    } else {
-        while (!frame) {
-            frame = frame_evict (flags);
-        }
-        if (!frame) {
-            PANIC ("Frame evict failed. Swap is full!");
+    while (!frame) {
+        bool swap_full = false;
+        frame = frame_evict (flags, &swap_full);
+        if (frame) {
+            direct_evict_cnt++;
+        } else {
+            frame = palloc_get_page (flags);
+            if (!frame && swap_full) {
+                // Fail the faulting process rather than the kernel.
+                swap_full_cnt++;
+                return NULL;
+            }
         }
-        frame_add (frame, page_entry);
+    }
+    frame_add (frame, page_entry);
+    frame_fault_cnt++;
+
+    if (frame_free_cnt () < pageout_low && !pageout_running && pageout_high > 0) {
+        pageout_running = true;
+        sema_up (&pageout_wake);
     }
     return frame;
 }
@@ -53,72 +322,485 @@ frame_alloc (enum palloc_flags flags, struct SP_entry *page_entry)
 void
 frame_free (void *frame)
 {
-    struct list_elem *e;
+    if (!frame) {
+        return;
+    }
+    struct frame_entry *frame_entry = frame_to_entry (frame);
 
+    // The frame may have been evicted and handed to another thread
+    // since the caller looked it up.  If it's shared, only drop the
+    // running thread's mapping.
     lock_acquire (&frame_table_lock);
-    for (e = list_begin (&frame_table); e != list_end (&frame_table); e = list_next (e)) {
-        struct frame_entry *frame_entry = list_entry (e, struct frame_entry, elem);
-        if (frame_entry->frame == frame) {
-            list_remove (e);
-            free (frame_entry);
-            palloc_free_page (frame);
-            break;
+    if (!frame_entry->page_entry) {
+        // Not in use.
+    } else if (frame_entry->thread != thread_current ()) {
+        struct list_elem *e;
+        for (e = list_begin (&frame_entry->sharers);
+             e != list_end (&frame_entry->sharers); e = list_next (e)) {
+            if (list_entry (e, struct SP_entry, share_elem)->thread == thread_current ()) {
+                list_remove (e);
+                frame_entry->ref_cnt--;
+                break;
+            }
         }
+    } else if (!list_empty (&frame_entry->sharers)) {
+        struct SP_entry *page_entry = list_entry (list_pop_front (&frame_entry->sharers),
+                                                  struct SP_entry, share_elem);
+        frame_entry->page_entry = page_entry;
+        frame_entry->thread = page_entry->thread;
+        frame_entry->ref_cnt--;
+    } else {
+        frame_unlink (frame_entry);
+        frame_text_remove (frame_entry);
+        frame_entry->page_entry = NULL;
+        frame_entry->thread = NULL;
+        frame_entry->ref_cnt = 0;
+        frame_used_cnt--;
+        palloc_free_page (frame);
     }
     lock_release (&frame_table_lock);
 }
 
+// Adds PAGE_ENTRY, a page of the running thread, as another mapping
+// of FRAME, which must be in use.
+void
+frame_share (void *frame, struct SP_entry *page_entry)
+{
+    struct frame_entry *frame_entry = frame_to_entry (frame);
+    lock_acquire (&frame_table_lock);
+    ASSERT (frame_entry->page_entry != NULL);
+    page_entry->thread = thread_current ();
+    list_push_back (&frame_entry->sharers, &page_entry->share_elem);
+    frame_entry->ref_cnt++;
+    lock_release (&frame_table_lock);
+}
+
+// Looks up the frame holding READ_BYTES bytes of INODE at OFFSET in
+// the text cache.  If there is one, adds PAGE_ENTRY, a page of the
+// running thread, as another mapping of it and returns it; otherwise
+// returns a null pointer.
+void *
+frame_text_share (struct inode *inode, size_t offset, size_t read_bytes,
+                  struct SP_entry *page_entry)
+{
+    struct frame_entry key;
+    void *frame = NULL;
+    key.inode = inode;
+    key.offset = offset;
+    key.read_bytes = read_bytes;
+
+    lock_acquire (&frame_table_lock);
+    struct hash_elem *e = hash_find (&text_cache, &key.text_elem);
+    if (e) {
+        struct frame_entry *frame_entry = hash_entry (e, struct frame_entry, text_elem);
+        page_entry->thread = thread_current ();
+        list_push_back (&frame_entry->sharers, &page_entry->share_elem);
+        frame_entry->ref_cnt++;
+        frame = frame_entry->frame;
+        text_share_cnt++;
+    }
+    lock_release (&frame_table_lock);
+    return frame;
+}
+
+// Puts FRAME, which holds READ_BYTES bytes of INODE at OFFSET
+// followed by zeros, into the text cache, unless another frame with
+// the same contents got there first.
+void
+frame_text_add (void *frame, struct inode *inode, size_t offset,
+                size_t read_bytes)
+{
+    struct frame_entry *frame_entry = frame_to_entry (frame);
+    lock_acquire (&frame_table_lock);
+    ASSERT (frame_entry->page_entry != NULL && frame_entry->inode == NULL);
+    frame_entry->inode = inode;
+    frame_entry->offset = offset;
+    frame_entry->read_bytes = read_bytes;
+    if (hash_insert (&text_cache, &frame_entry->text_elem)) {
+        frame_entry->inode = NULL;
+    }
+    lock_release (&frame_table_lock);
+}
+
+// Returns the number of pages mapping FRAME.
+unsigned
+frame_ref_cnt (void *frame)
+{
+    struct frame_entry *frame_entry = frame_to_entry (frame);
+    lock_acquire (&frame_table_lock);
+    unsigned ref_cnt = frame_entry->ref_cnt;
+    lock_release (&frame_table_lock);
+    return ref_cnt;
+}
+
 void
 frame_add (void *frame, struct SP_entry *page_entry)
 {
-    struct frame_entry *frame_entry = malloc (sizeof (struct frame_entry));
-    frame_entry->frame = frame;
+    struct frame_entry *frame_entry = frame_to_entry (frame);
+    ASSERT (frame_entry->page_entry == NULL);
     frame_entry->page_entry = page_entry;
     frame_entry->thread = thread_current ();
+    frame_entry->ref_cnt = 1;
     lock_acquire (&frame_table_lock);
-    list_push_back (&frame_table, &frame_entry->elem);
+    // Insert just behind the hand, so the new page gets a full
+    // revolution before it's considered for eviction.
+    list_insert (clock_hand, &frame_entry->elem);
+    frame_used_cnt++;
     lock_release (&frame_table_lock);
 }
 
+// Returns the frame hand E points at, wrapping list_end around to
+// the beginning.  frame_table must not be empty.
+static struct list_elem *
+clock_start (struct list_elem *e)
+{
+    return e == list_end (&frame_table) ? list_begin (&frame_table) : e;
+}
+
+// Returns the element after E in clock order.
+static struct list_elem *
+clock_next (struct list_elem *e)
+{
+    return clock_start (list_next (e));
+}
+
+// Removes FRAME_ENTRY from frame_table, moving any hand that points
+// at it to the next frame.  frame_table_lock must be held.
+static void
+frame_unlink (struct frame_entry *frame_entry)
+{
+    struct list_elem *e = &frame_entry->elem;
+    if (clock_hand == e) {
+        clock_hand = list_next (e);
+    }
+    if (evict_hand == e) {
+        evict_hand = list_next (e);
+    }
+    list_remove (e);
+}
+
+// Returns true if FRAME_ENTRY may be evicted: none of the pages
+// mapping it is pinned or being written out.  A shared frame is
+// unmapped from every process at once.
+static bool
+frame_evictable (struct frame_entry *frame_entry)
+{
+    struct list_elem *e;
+    if (frame_entry->page_entry->pinned || frame_entry->page_entry->in_transit) {
+        return false;
+    }
+    for (e = list_begin (&frame_entry->sharers); e != list_end (&frame_entry->sharers);
+         e = list_next (e)) {
+        struct SP_entry *sharer = list_entry (e, struct SP_entry, share_elem);
+        if (sharer->pinned || sharer->in_transit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if any process sharing FRAME_ENTRY besides its owner
+// has its mapping marked dirty.  A frame shared by fork() keeps the
+// dirty bit the parent had, and it's dirty for all of them.
+static bool
+frame_sharers_dirty (struct frame_entry *frame_entry)
+{
+    struct list_elem *e;
+    for (e = list_begin (&frame_entry->sharers); e != list_end (&frame_entry->sharers);
+         e = list_next (e)) {
+        struct SP_entry *sharer = list_entry (e, struct SP_entry, share_elem);
+        if (pagedir_is_dirty (sharer->thread->pagedir, sharer->page)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if any page mapping FRAME_ENTRY was accessed since
+// its accessed bit was last cleared, clearing the bits if CLEAR.
+static bool
+frame_accessed (struct frame_entry *frame_entry, bool clear)
+{
+    struct thread *t = frame_entry->thread;
+    void *page = frame_entry->page_entry->page;
+    bool accessed = pagedir_is_accessed (t->pagedir, page);
+    struct list_elem *e;
+
+    if (clear) {
+        pagedir_set_accessed (t->pagedir, page, false);
+    }
+    for (e = list_begin (&frame_entry->sharers); e != list_end (&frame_entry->sharers);
+         e = list_next (e)) {
+        struct SP_entry *page_entry = list_entry (e, struct SP_entry, share_elem);
+        uint32_t *pd = page_entry->thread->pagedir;
+        accessed = pagedir_is_accessed (pd, page_entry->page) || accessed;
+        if (clear) {
+            pagedir_set_accessed (pd, page_entry->page, false);
+        }
+    }
+    return accessed;
+}
+
+// Returns true if FRAME_ENTRY's page was accessed since the last
+// call, clearing its accessed bit.
+static bool
+frame_test_and_clear_accessed (struct frame_entry *frame_entry)
+{
+    return frame_accessed (frame_entry, true);
+}
+
+// One-handed clock: gives recently accessed pages a second chance.
+static struct frame_entry *
+clock_select (size_t budget)
+{
+    struct list_elem *e = clock_start (clock_hand);
+    for (; budget > 0; budget--) {
+        struct frame_entry *frame_entry = list_entry (e, struct frame_entry, elem);
+        e = clock_next (e);
+        hand_travel_cnt++;
+        if (frame_evictable (frame_entry)
+            && !frame_test_and_clear_accessed (frame_entry)) {
+            clock_hand = e;
+            return frame_entry;
+        }
+    }
+    clock_hand = e;
+    return NULL;
+}
+
+// Two-handed clock: the front hand clears accessed bits and the back
+// hand, hand_spread frames behind, evicts the first evictable page not
+// accessed in between.  A page touched once by a sequential scan is
+// thus evicted before pages in active use, which the one-handed clock
+// would also clear and then evict in FIFO order.
+static struct frame_entry *
+clock2_select (size_t budget)
+{
+    struct list_elem *front = clock_start (clock_hand);
+    struct list_elem *back = evict_hand;
+    if (back == list_end (&frame_table)) {
+        // Restart the back hand hand_spread frames behind the front.
+        size_t i;
+        back = front;
+        for (i = 0; i < hand_spread; i++) {
+            front = clock_next (front);
+        }
+    }
+
+    for (; budget > 0; budget--) {
+        struct frame_entry *frame_entry;
+
+        frame_entry = list_entry (front, struct frame_entry, elem);
+        frame_test_and_clear_accessed (frame_entry);
+        front = clock_next (front);
+
+        frame_entry = list_entry (back, struct frame_entry, elem);
+        back = clock_next (back);
+        hand_travel_cnt++;
+        if (frame_evictable (frame_entry) && !frame_accessed (frame_entry, false)) {
+            clock_hand = front;
+            evict_hand = back;
+            return frame_entry;
+        }
+    }
+    clock_hand = front;
+    evict_hand = back;
+    return NULL;
+}
+
+// Picks the next frame to evict with the boot-selected clock, or
+// returns null if every frame is pinned or shared.
+// frame_table_lock must be held.
+static struct frame_entry *
+frame_select_victim (void)
+{
+    if (list_empty (&frame_table)) {
+        return NULL;
+    }
+    size_t budget = 2 * list_size (&frame_table);
+    struct frame_entry *victim = frame_two_handed ? clock2_select (budget)
+                                                  : clock_select (budget);
+    if (victim) {
+        select_cnt++;
+    }
+    return victim;
+}
+
+// Drops the swap slot kept by a resident, unpinned page whose
+// contents are also in memory, so the slot can be reused.  Returns
+// false if no page has one.  frame_table_lock must be held.
+static bool
+frame_reclaim_swap (void)
+{
+    struct list_elem *e;
+    for (e = list_begin (&frame_table); e != list_end (&frame_table);
+         e = list_next (e)) {
+        struct SP_entry *page_entry = list_entry (e, struct frame_entry, elem)->page_entry;
+        if (!page_entry->pinned && page_entry->swap_index != SWAP_NONE) {
+            swap_free (page_entry->swap_index);
+            page_entry->swap_index = SWAP_NONE;
+            swap_reclaim_cnt++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Evicts a frame and returns it for reuse, or returns null if no
+// frame could be evicted right now.  In that case, *SWAP_FULL (if
+// non-null) is set to true if it's because pages need swap and swap
+// is full.  Eviction runs in phases so that frame_table_lock is not
+// held across disk I/O:
+//   1. pick a victim and unmap it, under the lock, marking its page
+//      in transit so its owner waits in page_load() instead of
+//      reloading stale data, and allocate a swap slot if it needs
+//      one;
+//   2. write it to swap or its mmap file without the lock;
+//   3. under the lock again, record where the page went and wake
+//      any thread waiting for it.
+// A page loaded from swap keeps its slot, so evicting it again
+// while it's clean takes no I/O at all.
 void *
-frame_evict (enum palloc_flags flags)
+frame_evict (enum palloc_flags flags, bool *swap_full)
 {
     lock_acquire (&frame_table_lock);
-    struct list_elem *e = list_begin (&frame_table);
+    struct frame_entry *victim;
+    struct SP_entry *page_entry;
+    struct thread *t;
+    bool dirty, needs_slot;
+    size_t tries = list_size (&frame_table);
+    for (;;) {
+        victim = frame_select_victim ();
+        if (!victim || tries-- == 0) {
+            lock_release (&frame_table_lock);
+            if (swap_full) {
+                *swap_full = victim != NULL;
+            }
+            thread_yield ();
+            return NULL;
+        }
+        page_entry = victim->page_entry;
+        t = victim->thread;
 
-    while (true) {
-        struct frame_entry *frame_entry = list_entry (e, struct frame_entry, elem);
-        struct SP_entry *page_entry = frame_entry->page_entry;
-        if (!page_entry->pinned) {
-            struct thread *t = frame_entry->thread;
-            if (pagedir_is_accessed (t->pagedir, page_entry->page)) {
-                pagedir_set_accessed (t->pagedir, page_entry->page, false);
-            } else {
-                if (pagedir_is_dirty (t->pagedir, page_entry->page) ||
-                    page_entry->type == SP_SWAP) {
-                    if (page_entry->type == SP_MMAP) {
-                        lock_acquire (&filesys_lock);
-                        file_write_at (page_entry->file, frame_entry->frame,
-                                       page_entry->read_bytes,
-                                       page_entry->offset);
-                        lock_release (&filesys_lock);
-                    } else {
-                        page_entry->type = SP_SWAP;
-                        page_entry->swap_index = swap_out (frame_entry->frame);
-                    }
-                }
-                page_entry->is_loaded = false;
-                list_remove (&frame_entry->elem);
-                pagedir_clear_page (t->pagedir, page_entry->page);
-                palloc_free_page (frame_entry->frame);
-                free (frame_entry);
-                lock_release (&frame_table_lock);
-                return palloc_get_page (flags);
+        // Don't let the owner dirty the page between the check and the unmap.
+        // Sharers map it read-only, so they can't dirty it.
+        enum intr_level old_level = intr_disable ();
+        dirty = pagedir_is_dirty (t->pagedir, page_entry->page)
+                || frame_sharers_dirty (victim);
+        pagedir_clear_page (t->pagedir, page_entry->page);
+        intr_set_level (old_level);
+
+        // A slot other pages still read from can't be overwritten, so
+        // new contents go to a slot of their own.
+        if (dirty && page_entry->swap_index != SWAP_NONE
+            && swap_shared (page_entry->swap_index)) {
+            swap_free (page_entry->swap_index);
+            page_entry->swap_index = SWAP_NONE;
+        }
+
+        // Anonymous data without a copy in swap needs a slot.
+        needs_slot = page_entry->type != SP_MMAP
+                          && page_entry->swap_index == SWAP_NONE
+                          && (dirty || page_entry->type == SP_SWAP);
+        if (!needs_slot) {
+            break;
+        }
+        page_entry->swap_index = swap_alloc (t, page_entry);
+        if (page_entry->swap_index == SWAP_NONE && frame_reclaim_swap ()) {
+            page_entry->swap_index = swap_alloc (t, page_entry);
+        }
+        if (page_entry->swap_index != SWAP_NONE) {
+            break;
+        }
+
+        // Swap is full.  Map the page back and try another, which may
+        // be clean or already have a slot.
+        if (!pagedir_set_page (t->pagedir, page_entry->page, victim->frame,
+                               page_entry->writable)) {
+            PANIC ("Can't remap page after failed eviction.");
+        }
+        pagedir_set_dirty (t->pagedir, page_entry->page, dirty);
+    }
+
+    frame_unlink (victim);
+    frame_text_remove (victim);
+    page_entry->is_loaded = false;
+    page_entry->cow = false;
+    page_entry->in_transit = true;
+
+    // The other processes sharing the frame lose their mappings too.
+    // A text page, or a clean file page shared by fork(), is faulted
+    // back in from the file.  Otherwise they all share the owner's
+    // swap slot, and wait like the owner until it's written.
+    struct list_elem *e;
+    for (e = list_begin (&victim->sharers); e != list_end (&victim->sharers);
+         e = list_next (e)) {
+        struct SP_entry *sharer = list_entry (e, struct SP_entry, share_elem);
+        pagedir_clear_page (sharer->thread->pagedir, sharer->page);
+        sharer->is_loaded = false;
+        sharer->cow = false;
+        sharer->in_transit = true;
+        if (page_entry->swap_index != SWAP_NONE) {
+            if (sharer->swap_index != SWAP_NONE) {
+                swap_free (sharer->swap_index);
             }
+            swap_share (page_entry->swap_index);
+            sharer->swap_index = page_entry->swap_index;
+            cow_evict_cnt++;
+        } else {
+            text_unmap_cnt++;
+        }
+    }
+    lock_release (&frame_table_lock);
+
+    if (page_entry->type == SP_MMAP) {
+        if (dirty) {
+            lock_acquire (&filesys_lock);
+            file_write_at (page_entry->file, victim->frame,
+                           page_entry->read_bytes,
+                           page_entry->offset);
+            lock_release (&filesys_lock);
         }
-        e = list_next (e);
-        if (e == list_end (&frame_table)) {
-            e = list_begin (&frame_table);
+    } else if (needs_slot || (dirty && page_entry->swap_index != SWAP_NONE)) {
+        swap_out (page_entry->swap_index, victim->frame);
+    } else if (page_entry->swap_index != SWAP_NONE) {
+        clean_evict_cnt++;
+    }
+
+    lock_acquire (&frame_table_lock);
+    if (page_entry->swap_index != SWAP_NONE) {
+        page_entry->type = SP_SWAP;
+    }
+    page_entry->in_transit = false;
+    while (!list_empty (&victim->sharers)) {
+        struct SP_entry *sharer = list_entry (list_pop_front (&victim->sharers),
+                                              struct SP_entry, share_elem);
+        if (sharer->swap_index != SWAP_NONE) {
+            sharer->type = SP_SWAP;
         }
+        sharer->in_transit = false;
     }
+    cond_broadcast (&frame_io_done, &frame_table_lock);
+    victim->page_entry = NULL;
+    victim->thread = NULL;
+    victim->ref_cnt = 0;
+    frame_used_cnt--;
+    lock_release (&frame_table_lock);
+
+    if (flags & PAL_ZERO) {
+        memset (victim->frame, 0, PGSIZE);
+    }
+    return victim->frame;
+}
+
+// Waits until PAGE_ENTRY is no longer being written out by
+// frame_evict().
+void
+frame_wait_io (struct SP_entry *page_entry)
+{
+    lock_acquire (&frame_table_lock);
+    while (page_entry->in_transit) {
+        cond_wait (&frame_io_done, &frame_table_lock);
+    }
+    lock_release (&frame_table_lock);
 }
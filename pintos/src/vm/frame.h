@@ -1,23 +1,49 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
+#include <hash.h>
 #include <list.h>
 #include "threads/palloc.h"
 #include "vm/page.h"
 
+// One entry per frame of the user pool, indexed by frame number.
+// page_entry is null while the frame is free.  A frame shared by
+// fork() is also mapped by the pages in sharers, each of another
+// process, and is evicted from all of them at once.
 struct frame_entry {
     void *frame;
     struct SP_entry *page_entry;
     struct thread *thread;
-    struct list_elem elem;
+    struct list_elem elem;      // In frame_table while in use
+    unsigned ref_cnt;           // Mappings, page_entry's included
+    struct list sharers;        // SP_entry share_elems
+
+    // A read-only file page is also in the text cache, so that every
+    // process running the same executable maps the same frame.
+    struct inode *inode;        // Non-null if in the text cache
+    size_t offset;
+    size_t read_bytes;
+    struct hash_elem text_elem;
 };
 
+extern bool frame_two_handed;
+
 void frame_table_init (void);
+void frame_pageout_start (void);
+void frame_print_stats (void);
+bool frame_has_spare (void);
 
 void* frame_alloc (enum palloc_flags flags, struct SP_entry *page_entry);
 void frame_free (void *frame);
+void frame_share (void *frame, struct SP_entry *page_entry);
+unsigned frame_ref_cnt (void *frame);
+void *frame_text_share (struct inode *, size_t offset, size_t read_bytes,
+                        struct SP_entry *page_entry);
+void frame_text_add (void *frame, struct inode *, size_t offset,
+                     size_t read_bytes);
 
 void frame_add (void *frame, struct SP_entry *page_entry);
-void* frame_evict (enum palloc_flags flags);
+void* frame_evict (enum palloc_flags flags, bool *swap_full);
+void frame_wait_io (struct SP_entry *page_entry);
 
 #endif /* vm/frame.h */
@@ -1,8 +1,9 @@
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "threads/interrupt.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -25,6 +26,25 @@
 //
 //
 
+static struct kmem_cache *page_entry_cache;
+
+// All-zero pages (BSS and untouched stack) are mapped read-only to
+// this page until they are first written.
+static void *zero_page;
+
+void
+page_init (void)
+{
+    page_entry_cache = kmem_cache_create ("SP_entry", sizeof (struct SP_entry), NULL);
+    zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+void
+page_entry_free (struct SP_entry *page_entry)
+{
+    kmem_cache_free (page_entry_cache, page_entry);
+}
+
 static unsigned
 page_hash_func (const struct hash_elem *e, void *aux UNUSED)
 {
@@ -47,11 +67,22 @@ static void
 page_action_func (struct hash_elem *e, void *aux UNUSED)
 {
     struct SP_entry *page_entry = hash_entry(e, struct SP_entry, elem);
+    // Pin first, so that no eviction can pick the page once
+    // frame_wait_io() has seen it settle.
+    page_entry->pinned = true;
+    frame_wait_io (page_entry);
     if (page_entry->is_loaded) {
-        frame_free (pagedir_get_page (thread_current()->pagedir, page_entry->page));
+        if (!page_entry->zero_mapped) {
+            frame_free (pagedir_get_page (thread_current()->pagedir, page_entry->page));
+        }
         pagedir_clear_page (thread_current()->pagedir, page_entry->page);
     }
-    free(page_entry);
+    // Read after frame_free(), since frame_reclaim_swap() may drop the
+    // slot of a page still in the frame table.
+    if (page_entry->swap_index != SWAP_NONE) {
+        swap_free (page_entry->swap_index);
+    }
+    page_entry_free (page_entry);
 }
 
 static struct SP_entry*
@@ -68,6 +99,20 @@ get_page_entry (const void *page)
 }
 
 
+// Pages after a faulting page's swap slot to read in along with it.
+#define SWAP_READAHEAD 4
+
+static unsigned long long readahead_cnt;
+static unsigned long long cow_share_cnt;       // Frames shared by fork()
+static unsigned long long cow_copy_cnt;        // Copies made on write
+static unsigned long long fault_around_cnt;    // Loaded by fault_around()
+
+// Most pages fault_around() loads per fault, including the faulting
+// page.  Set by the kernel command-line option "-fault-around=N", up
+// to FAULT_AROUND_MAX.
+#define FAULT_AROUND_MAX 32
+size_t page_fault_around = 16;
+
 static bool
 load_swap (struct SP_entry *page_entry)
 {
@@ -75,44 +120,292 @@ load_swap (struct SP_entry *page_entry)
     if (!frame) {
         return false;
     }
+    // Read through the kernel mapping so the user PTE isn't marked
+    // accessed or dirty by the load itself.
+    swap_in (page_entry->swap_index, frame);
     if (!install_page (page_entry->page, frame, page_entry->writable)) {
         frame_free (frame);
         return false;
     }
-    swap_in (page_entry->swap_index, page_entry->page);
     page_entry->is_loaded = true;
     return true;
 }
 
+// Reads in the running thread's pages that were swapped out to the
+// slots following SLOT, which swap_alloc() clustered together, as long
+// as frames are plentiful.  They come in unaccessed, so the clock
+// takes them back on its next pass if they go unused.
+static void
+swap_readahead (size_t slot)
+{
+    size_t i;
+    for (i = 1; i < SWAP_READAHEAD && frame_has_spare (); i++) {
+        struct SP_entry *page_entry = swap_slot_page (slot + i);
+        if (!page_entry) {
+            break;
+        }
+        frame_wait_io (page_entry);
+        if (page_entry->is_loaded || page_entry->type != SP_SWAP
+            || page_entry->swap_index != slot + i) {
+            continue;
+        }
+        page_entry->pinned = true;
+        if (load_swap (page_entry)) {
+            readahead_cnt++;
+        }
+        page_entry->pinned = false;
+    }
+}
+
+void
+page_print_stats (void)
+{
+    printf ("Pages: %llu read ahead from swap, %llu shared by fork, "
+            "%llu copied on write, %llu loaded by fault-around\n",
+            readahead_cnt, cow_share_cnt, cow_copy_cnt, fault_around_cnt);
+}
+
+static bool
+load_zero (struct SP_entry *page_entry)
+{
+    if (!install_page (page_entry->page, zero_page, false)) {
+        return false;
+    }
+    page_entry->zero_mapped = true;
+    page_entry->is_loaded = true;
+    return true;
+}
+
+// Replaces the shared zero page mapped for PAGE_ENTRY with a private
+// zeroed frame, on the first write to the page.
 static bool
-load_file (struct SP_entry *page_entry)
+unshare_zero (struct SP_entry *page_entry)
 {
-    void *frame = frame_alloc (PAL_USER, page_entry);
+    uint32_t *pd = thread_current ()->pagedir;
+    void *frame = frame_alloc (PAL_USER | PAL_ZERO, page_entry);
     if (!frame) {
         return false;
     }
+    pagedir_clear_page (pd, page_entry->page);
+    page_entry->zero_mapped = false;
+    if (!install_page (page_entry->page, frame, page_entry->writable)) {
+        page_entry->is_loaded = false;
+        frame_free (frame);
+        return false;
+    }
+    return true;
+}
 
-    if (page_entry->read_bytes > 0) {
-        lock_acquire (&filesys_lock);
-        if ((int) page_entry->read_bytes != file_read_at (page_entry->file, frame, page_entry->read_bytes, page_entry->offset)) {
-            lock_release (&filesys_lock);
-            frame_free (frame);
+// Gives PAGE_ENTRY a private, writable frame in place of the frame
+// it shares copy-on-write since fork(), on the first write to the
+// page.  If no other process maps the frame any more, it's kept.
+static bool
+unshare_cow (struct SP_entry *page_entry)
+{
+    uint32_t *pd = thread_current ()->pagedir;
+    void *old_frame = pagedir_get_page (pd, page_entry->page);
+    void *frame = old_frame;
+    bool dirty = pagedir_is_dirty (pd, page_entry->page);
+
+    if (frame_ref_cnt (old_frame) > 1) {
+        frame = frame_alloc (PAL_USER, page_entry);
+        if (!frame) {
             return false;
         }
-        lock_release (&filesys_lock);
+        memcpy (frame, old_frame, PGSIZE);
+        frame_free (old_frame);
+        cow_copy_cnt++;
+    }
+    pagedir_clear_page (pd, page_entry->page);
+    if (!install_page (page_entry->page, frame, page_entry->writable)) {
+        page_entry->is_loaded = false;
+        frame_free (frame);
+        return false;
+    }
+    pagedir_set_dirty (pd, page_entry->page, dirty);
+    page_entry->cow = false;
+    return true;
+}
+
+// Returns the inode whose text cache PAGE_ENTRY may use, or a null
+// pointer.  Read-only pages of an executable are shared by every
+// process running it.
+static struct inode *
+text_inode (struct SP_entry *page_entry)
+{
+    if (page_entry->type == SP_FILE && !page_entry->writable && page_entry->file) {
+        return file_get_inode (page_entry->file);
     }
+    return NULL;
+}
 
+// Maps PAGE_ENTRY to a frame in the text cache, if there is one.
+static bool
+load_text_shared (struct SP_entry *page_entry)
+{
+    struct inode *inode = text_inode (page_entry);
+    if (!inode) {
+        return false;
+    }
+    void *frame = frame_text_share (inode, page_entry->offset,
+                                    page_entry->read_bytes, page_entry);
+    if (!frame) {
+        return false;
+    }
+    if (!install_page (page_entry->page, frame, false)) {
+        frame_free (frame);
+        return false;
+    }
+    page_entry->is_loaded = true;
+    return true;
+}
+
+// Reads PAGE_ENTRY's data from its file into FRAME.  filesys_lock
+// must be held.
+static bool
+read_file_page (struct SP_entry *page_entry, void *frame)
+{
+    return (page_entry->read_bytes == 0
+            || (int) page_entry->read_bytes == file_read_at (page_entry->file, frame,
+                                                             page_entry->read_bytes,
+                                                             page_entry->offset));
+}
+
+// Zeros the rest of FRAME, which read_file_page() filled for
+// PAGE_ENTRY, and maps it.  Frees FRAME on failure.
+static bool
+map_file_page (struct SP_entry *page_entry, void *frame)
+{
     memset (frame + page_entry->read_bytes, 0, page_entry->zero_bytes);
 
     if (!install_page (page_entry->page, frame, page_entry->writable)) {
         frame_free (frame);
         return false;
     }
+    struct inode *inode = text_inode (page_entry);
+    if (inode) {
+        frame_text_add (frame, inode, page_entry->offset, page_entry->read_bytes);
+    }
 
     page_entry->is_loaded = true;
     return true;
 }
 
+static bool
+load_file (struct SP_entry *page_entry, bool to_write)
+{
+    // Don't spend a frame on an all-zero page until it's written.
+    if (page_entry->type == SP_FILE && page_entry->read_bytes == 0 && !to_write) {
+        return load_zero (page_entry);
+    }
+    if (load_text_shared (page_entry)) {
+        return true;
+    }
+
+    void *frame = frame_alloc (PAL_USER, page_entry);
+    if (!frame) {
+        return false;
+    }
+
+    lock_acquire (&filesys_lock);
+    bool success = read_file_page (page_entry, frame);
+    lock_release (&filesys_lock);
+    if (!success) {
+        frame_free (frame);
+        return false;
+    }
+    return map_file_page (page_entry, frame);
+}
+
+// Returns the page after PAGE_ENTRY if it continues the same file
+// mapping and has data to read, otherwise a null pointer.
+static struct SP_entry *
+next_file_page (struct SP_entry *page_entry)
+{
+    if (page_entry->read_bytes != PGSIZE) {
+        return NULL;
+    }
+    struct SP_entry *next = get_page_entry (page_entry->page + PGSIZE);
+    if (!next || next->type != page_entry->type || next->file != page_entry->file
+        || next->offset != page_entry->offset + PGSIZE || next->read_bytes == 0) {
+        return NULL;
+    }
+    return next;
+}
+
+// Loads the pages following PAGE_ENTRY, just loaded by a fault, in
+// the same file mapping.  The window starts at one page, so random
+// faults read nothing extra, and doubles up to page_fault_around
+// pages as long as each fault lands just past the pages the last
+// one loaded.  Frames for the whole window are taken first, since
+// eviction may need filesys_lock, and then all of the reads are done
+// under a single acquisition of the lock.
+static void
+fault_around (struct SP_entry *page_entry)
+{
+    struct thread *t = thread_current ();
+    struct SP_entry *batch[FAULT_AROUND_MAX];
+    void *frames[FAULT_AROUND_MAX];
+    bool read_ok[FAULT_AROUND_MAX];
+    size_t loaded = 1, cnt = 0, i;
+
+    if (page_entry->page == t->fault_next) {
+        t->fault_window *= 2;
+    } else {
+        t->fault_window = 1;
+    }
+    if (t->fault_window > page_fault_around) {
+        t->fault_window = page_fault_around;
+    }
+    if (t->fault_window > FAULT_AROUND_MAX) {
+        t->fault_window = FAULT_AROUND_MAX;
+    }
+
+    struct SP_entry *next = page_entry;
+    while (loaded < t->fault_window && frame_has_spare ()) {
+        next = next_file_page (next);
+        if (!next) {
+            break;
+        }
+        next->pinned = true;
+        frame_wait_io (next);
+        if (next->is_loaded) {
+            next->pinned = false;
+            break;
+        }
+        loaded++;
+        if (load_text_shared (next)) {
+            next->pinned = false;
+            continue;
+        }
+        void *frame = frame_alloc (PAL_USER, next);
+        if (!frame) {
+            next->pinned = false;
+            loaded--;
+            break;
+        }
+        batch[cnt] = next;
+        frames[cnt++] = frame;
+    }
+    t->fault_next = page_entry->page + loaded * PGSIZE;
+
+    if (cnt > 0) {
+        lock_acquire (&filesys_lock);
+        for (i = 0; i < cnt; i++) {
+            read_ok[i] = read_file_page (batch[i], frames[i]);
+        }
+        lock_release (&filesys_lock);
+    }
+    for (i = 0; i < cnt; i++) {
+        if (!read_ok[i]) {
+            frame_free (frames[i]);
+        } else if (map_file_page (batch[i], frames[i])) {
+            fault_around_cnt++;
+        }
+        batch[i]->pinned = false;
+    }
+}
+
 //
 //                          ,,        ,,    ,,
 //   `7MM"""Mq.            *MM      `7MM    db
@@ -137,23 +430,134 @@ page_table_destroy (struct hash *page_table)
     hash_destroy (page_table, page_action_func);
 }
 
+// Sets up CHILD, a copy of PARENT made in the running thread's
+// page directory.  PARENT must be pinned.
+static bool
+clone_page (struct thread *parent, struct SP_entry *parent_entry,
+            struct SP_entry *child)
+{
+    uint32_t *ppd = parent->pagedir;
+    void *page = parent_entry->page;
+
+    if (!parent_entry->is_loaded) {
+        // Share the parent's slot.  Whichever process writes the page
+        // and evicts it again gets a slot of its own.
+        if (parent_entry->type == SP_SWAP) {
+            swap_share (parent_entry->swap_index);
+            child->swap_index = parent_entry->swap_index;
+            cow_share_cnt++;
+        }
+        return true;
+    }
+
+    if (parent_entry->zero_mapped) {
+        return load_zero (child);
+    }
+
+    void *frame = pagedir_get_page (ppd, page);
+    bool dirty = pagedir_is_dirty (ppd, page);
+    if (parent_entry->writable && !parent_entry->cow) {
+        // Write-protect the parent's mapping.  Its page table is
+        // already there, so this can't fail.
+        pagedir_clear_page (ppd, page);
+        if (!pagedir_set_page (ppd, page, frame, false)) {
+            PANIC ("Can't write-protect page for fork.");
+        }
+        pagedir_set_dirty (ppd, page, dirty);
+        parent_entry->cow = true;
+    }
+    if (!install_page (page, frame, false)) {
+        return false;
+    }
+    pagedir_set_dirty (thread_current ()->pagedir, page, dirty);
+    child->cow = child->writable;
+    child->is_loaded = true;
+    frame_share (frame, child);
+    cow_share_cnt++;
+    return true;
+}
+
+// Fills the running thread's page table, in a child made by fork(),
+// with copies of PARENT's pages.  Resident pages share the parent's
+// frames read-only, and writable ones are copied on the first write
+// by either process.  Pages in swap share the parent's slots.
+// Memory mappings aren't inherited.  PARENT must be
+// blocked until this returns.
 bool
-page_load (struct SP_entry *page_entry)
+page_table_clone (struct thread *parent)
+{
+    struct thread *cur = thread_current ();
+    struct hash_iterator i;
+
+    hash_first (&i, &parent->page_table);
+    while (hash_next (&i)) {
+        struct SP_entry *parent_entry = hash_entry (hash_cur (&i), struct SP_entry, elem);
+        if (parent_entry->type == SP_MMAP) {
+            continue;
+        }
+        struct SP_entry *page_entry = kmem_cache_alloc (page_entry_cache);
+        if (!page_entry) {
+            return false;
+        }
+
+        // Keep the parent's page where it is while it's copied.
+        parent_entry->pinned = true;
+        frame_wait_io (parent_entry);
+
+        *page_entry = *parent_entry;
+        if (page_entry->file == parent->file) {
+            page_entry->file = cur->file;
+        }
+        page_entry->is_loaded = false;
+        page_entry->zero_mapped = false;
+        page_entry->in_transit = false;
+        page_entry->cow = false;
+        page_entry->swap_index = SWAP_NONE;
+        if (hash_insert (&cur->page_table, &page_entry->elem)) {
+            page_entry_free (page_entry);
+            parent_entry->pinned = false;
+            return false;
+        }
+
+        bool success = clone_page (parent, parent_entry, page_entry);
+        page_entry->pinned = false;
+        parent_entry->pinned = false;
+        if (!success) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+page_load (struct SP_entry *page_entry, bool to_write)
 {
     bool success = false;
     page_entry->pinned = true;
+    frame_wait_io (page_entry);
     if (page_entry->is_loaded) {
         return success;
     }
     switch (page_entry->type) {
         case SP_FILE:
-            success = load_file (page_entry);
+            success = load_file (page_entry, to_write);
+            if (success && !page_entry->zero_mapped) {
+                fault_around (page_entry);
+            }
             break;
-        case SP_SWAP:
+        case SP_SWAP: {
+            size_t slot = page_entry->swap_index;
             success = load_swap (page_entry);
+            if (success) {
+                swap_readahead (slot);
+            }
             break;
+        }
         case SP_MMAP:
-            success = load_file (page_entry);
+            success = load_file (page_entry, to_write);
+            if (success) {
+                fault_around (page_entry);
+            }
             break;
         case SP_ERROR:
             PANIC ("SP type should not be ERROR");
@@ -179,14 +583,29 @@ page_find_and_load (const void * vaddr, const void * esp, const bool to_write)
             return false;
         }
 
-        if (page_entry->is_loaded || page_load (page_entry)) {
+        if (page_entry->is_loaded) {
+            if (to_write && page_entry->zero_mapped) {
+                page_entry->pinned = true;
+                if (!unshare_zero (page_entry)) {
+                    return false;
+                }
+            } else if (to_write && page_entry->cow) {
+                page_entry->pinned = true;
+                if (!unshare_cow (page_entry)) {
+                    return false;
+                }
+            }
+            page_entry->pinned = false;
+            return true;
+        }
+        if (page_load (page_entry, to_write)) {
             page_entry->pinned = false;
             return true;
         } else {
             return false;
         }
     } else if (vaddr >= esp - STACK_HEURISTIC) {
-        return grow_stack ((void *) vaddr);
+        return grow_stack ((void *) vaddr, to_write);
     } else {
         return false;
     }
@@ -199,7 +618,7 @@ page_add_file (struct file *file, int32_t ofs, uint8_t *upage,
 {
     ASSERT (read_bytes + zero_bytes == PGSIZE);
 
-    struct SP_entry *page_entry = malloc (sizeof (struct SP_entry));
+    struct SP_entry *page_entry = kmem_cache_alloc (page_entry_cache);
     if (!page_entry) {
         return false;
     }
@@ -212,6 +631,10 @@ page_add_file (struct file *file, int32_t ofs, uint8_t *upage,
     page_entry->is_loaded = false;
     page_entry->type = SP_FILE;
     page_entry->pinned = false;
+    page_entry->zero_mapped = false;
+    page_entry->in_transit = false;
+    page_entry->swap_index = SWAP_NONE;
+    page_entry->cow = false;
 
     return (hash_insert (&thread_current()->page_table, &page_entry->elem) == NULL);
 }
@@ -222,7 +645,7 @@ page_add_mmap(struct file *file, int32_t ofs, uint8_t *upage,
 {
     ASSERT (read_bytes + zero_bytes == PGSIZE);
 
-    struct SP_entry *page_entry = malloc (sizeof (struct SP_entry));
+    struct SP_entry *page_entry = kmem_cache_alloc (page_entry_cache);
     if (!page_entry) {
         return false;
     }
@@ -235,9 +658,13 @@ page_add_mmap(struct file *file, int32_t ofs, uint8_t *upage,
     page_entry->type = SP_MMAP;
     page_entry->writable = true;
     page_entry->pinned = false;
+    page_entry->zero_mapped = false;
+    page_entry->in_transit = false;
+    page_entry->swap_index = SWAP_NONE;
+    page_entry->cow = false;
 
     if (!process_add_mmap (page_entry)) {
-        free (page_entry);
+        page_entry_free (page_entry);
         return false;
     }
 
@@ -250,29 +677,51 @@ page_add_mmap(struct file *file, int32_t ofs, uint8_t *upage,
 }
 
 bool
-grow_stack (const void *page)
+grow_stack (const void *page, bool to_write)
 {
     if ((size_t) (PHYS_BASE - pg_round_down (page)) > MAX_STACK_SIZE) {
         return false;
     }
-    struct SP_entry *page_entry = malloc (sizeof (struct SP_entry));
+    struct SP_entry *page_entry = kmem_cache_alloc (page_entry_cache);
     if (!page_entry) {
         return false;
     }
     page_entry->page = pg_round_down (page);
-    page_entry->is_loaded = true;
     page_entry->writable = true;
-    page_entry->type = SP_SWAP;
     page_entry->pinned = true;
+    page_entry->zero_mapped = false;
+    page_entry->in_transit = false;
+    page_entry->swap_index = SWAP_NONE;
+    page_entry->cow = false;
+
+    // A stack page that has only been read so far is all zeros, so
+    // it can share the zero page until it's written.
+    if (!to_write) {
+        page_entry->type = SP_FILE;
+        page_entry->file = NULL;
+        page_entry->offset = 0;
+        page_entry->read_bytes = 0;
+        page_entry->zero_bytes = PGSIZE;
+        page_entry->is_loaded = false;
+        if (!load_zero (page_entry)) {
+            page_entry_free (page_entry);
+            return false;
+        }
+        page_entry->pinned = false;
+        return (hash_insert (&thread_current()->page_table, &page_entry->elem) == NULL);
+    }
+
+    page_entry->is_loaded = true;
+    page_entry->type = SP_SWAP;
 
     uint8_t *frame = frame_alloc (PAL_USER, page_entry);
     if (!frame) {
-        free(page_entry);
+        page_entry_free (page_entry);
         return false;
     }
 
     if (!install_page (page_entry->page, frame, page_entry->writable)) {
-        free (page_entry);
+        page_entry_free (page_entry);
         frame_free (frame);
         return false;
     }
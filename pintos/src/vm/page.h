@@ -21,6 +21,9 @@ struct SP_entry {
   bool is_loaded;
   bool writable;
   bool pinned;
+  bool zero_mapped;     // Loaded as the shared zero page, read-only
+  bool in_transit;      // Being written out by frame_evict()
+  bool cow;             // Frame shared read-only, copied on write
 
   // File
   struct file *file;
@@ -31,13 +34,24 @@ struct SP_entry {
   // Swap
   size_t swap_index;
 
+  // Frame sharing
+  struct thread *thread;        // Owner, while in a frame's sharers
+  struct list_elem share_elem;  // In frame_entry's sharers
+
   struct hash_elem elem;
 };
 
+extern size_t page_fault_around;
+
+void page_init (void);
+void page_print_stats (void);
+void page_entry_free (struct SP_entry *page_entry);
+
 void page_table_init (struct hash *page_table);
 void page_table_destroy (struct hash *page_table);
+bool page_table_clone (struct thread *parent);
 
-bool page_load (struct SP_entry *page_entry);
+bool page_load (struct SP_entry *page_entry, bool to_write);
 bool page_find (const void * vaddr);
 bool page_find_and_load (const void * vaddr, const void * esp, const bool to_write);
 bool page_add_file (struct file *file, int32_t ofs, uint8_t *upage,
@@ -45,6 +59,6 @@ bool page_add_file (struct file *file, int32_t ofs, uint8_t *upage,
                     bool writable);
 bool page_add_mmap (struct file *file, int32_t ofs, uint8_t *upage,
                     uint32_t read_bytes, uint32_t zero_bytes);
-bool grow_stack (const void *page);
+bool grow_stack (const void *page, bool to_write);
 
 #endif /* vm/page.h */
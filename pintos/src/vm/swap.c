@@ -1,13 +1,45 @@
 #include "vm/swap.h"
+#include <round.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "vm/page.h"
 
 #define SWAP_FREE 0
 #define SWAP_IN_USE 1
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+// Slots handed to a thread at a time.  A thread's pages are written
+// to consecutive slots of its cluster, so pages evicted together sit
+// together on disk and can be read back together.
+#define SWAP_CLUSTER 16
+
 struct lock swap_lock;
 struct block *swap_block;
 struct bitmap *swap_map;
 
+// Owner of each slot in use, for readahead, and the number of pages
+// whose contents are in it.  A slot shared by pages of processes
+// related by fork() has no owner.
+struct swap_slot {
+    struct thread *thread;
+    struct SP_entry *page_entry;
+    unsigned ref_cnt;
+};
+static struct swap_slot *swap_slots;
+static size_t swap_slot_cnt;
+
+// Where to look for the next free cluster, so that clusters are
+// handed out in order instead of all threads sharing the first one.
+static size_t swap_cluster_hint;
+
+// Statistics.
+static unsigned long long swap_in_cnt;
+static unsigned long long swap_out_cnt;
+static unsigned long long swap_cluster_cnt;    // Clusters handed out
+static unsigned long long swap_fail_cnt;       // Allocations failed, full
+static size_t swap_used_cnt, swap_peak_cnt;    // Slots in use
+
 //
 //                          ,,        ,,    ,,
 //   `7MM"""Mq.            *MM      `7MM    db
@@ -26,52 +58,171 @@ swap_init (void)
     swap_block = block_get_role (BLOCK_SWAP);
     ASSERT (swap_block != NULL && "BLOCK_SWAP is needed for swap!");
 
-    swap_map = bitmap_create (block_size (swap_block) / SECTORS_PER_PAGE );
+    swap_slot_cnt = block_size (swap_block) / SECTORS_PER_PAGE;
+    swap_map = bitmap_create (swap_slot_cnt);
     ASSERT (swap_map != NULL && "swap_map is needed for swap!");
 
+    size_t slot_pages = DIV_ROUND_UP (swap_slot_cnt * sizeof *swap_slots, PGSIZE);
+    swap_slots = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, slot_pages);
+
     bitmap_set_all (swap_map, SWAP_FREE);
     lock_init (&swap_lock);
 }
 
+void
+swap_print_stats (void)
+{
+    if (!swap_map) {
+        return;
+    }
+    printf ("Swap: %zu of %zu slots in use (peak %zu), %llu pages in, "
+            "%llu pages out, %llu clusters, %llu allocations failed\n",
+            swap_used_cnt, swap_slot_cnt, swap_peak_cnt, swap_in_cnt,
+            swap_out_cnt, swap_cluster_cnt, swap_fail_cnt);
+}
+
+// Reads the page in slot USED_INDEX into FRAME.  The slot stays
+// allocated, so that a clean copy can be evicted again without
+// writing it.
 void
 swap_in (size_t used_index, void* frame)
 {
     if (!swap_block || !swap_map) {
         return;
     }
-    lock_acquire (&swap_lock);
+    ASSERT (used_index < swap_slot_cnt);
     if (bitmap_test (swap_map, used_index) == SWAP_FREE) {
         PANIC ("Free swap can not be swap again.");
     }
-    bitmap_flip (swap_map, used_index);
+    block_read_multiple (swap_block, used_index * SECTORS_PER_PAGE,
+                         SECTORS_PER_PAGE, frame);
+    swap_in_cnt++;
+}
 
-    size_t i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++) {
-        block_read (swap_block, used_index * SECTORS_PER_PAGE + i,
-                    (uint8_t *) frame + i * BLOCK_SECTOR_SIZE);
+// Returns a free slot for a page of thread T: the next slot of T's
+// cluster if it's still free, otherwise the first slot of a new
+// cluster, otherwise any free slot.  swap_lock must be held.
+static size_t
+swap_alloc_slot (struct thread *t)
+{
+    size_t idx = t->swap_next;
+    if (idx < swap_slot_cnt && bitmap_test (swap_map, idx) == SWAP_FREE) {
+        bitmap_mark (swap_map, idx);
+        t->swap_next = idx + 1;
+        return idx;
     }
-    lock_release (&swap_lock);
+
+    size_t start = swap_cluster_hint < swap_slot_cnt ? swap_cluster_hint : 0;
+    idx = bitmap_scan (swap_map, start, SWAP_CLUSTER, SWAP_FREE);
+    if (idx == BITMAP_ERROR && start > 0) {
+        idx = bitmap_scan (swap_map, 0, SWAP_CLUSTER, SWAP_FREE);
+    }
+    if (idx != BITMAP_ERROR) {
+        swap_cluster_hint = idx + SWAP_CLUSTER;
+        swap_cluster_cnt++;
+    } else {
+        idx = bitmap_scan (swap_map, 0, 1, SWAP_FREE);
+        if (idx == BITMAP_ERROR) {
+            return SWAP_NONE;
+        }
+    }
+    bitmap_mark (swap_map, idx);
+    t->swap_next = idx + 1;
+    return idx;
 }
 
+// Allocates a slot for PAGE_ENTRY, a page of thread T, and returns
+// it, or returns SWAP_NONE if swap is full.
 size_t
-swap_out (void *frame)
+swap_alloc (struct thread *t, struct SP_entry *page_entry)
 {
     if (!swap_block || !swap_map) {
         PANIC ("No swap partition is available.");
     }
     lock_acquire (&swap_lock);
-    size_t free_index = bitmap_scan_and_flip (swap_map, 0, 1, SWAP_FREE);
-
-    if (free_index == BITMAP_ERROR) {
-        PANIC ("Swap partition is full.");
+    size_t free_index = swap_alloc_slot (t);
+    if (free_index != SWAP_NONE) {
+        swap_slots[free_index].thread = t;
+        swap_slots[free_index].page_entry = page_entry;
+        swap_slots[free_index].ref_cnt = 1;
+        if (++swap_used_cnt > swap_peak_cnt) {
+            swap_peak_cnt = swap_used_cnt;
+        }
+    } else {
+        swap_fail_cnt++;
     }
+    lock_release (&swap_lock);
+    return free_index;
+}
 
-    size_t i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++) {
-        block_write (swap_block, free_index * SECTORS_PER_PAGE + i,
-                     (uint8_t *) frame + i * BLOCK_SECTOR_SIZE);
+// Writes FRAME to slot USED_INDEX, which must be allocated.
+void
+swap_out (size_t used_index, void *frame)
+{
+    ASSERT (used_index < swap_slot_cnt);
+    ASSERT (bitmap_test (swap_map, used_index) == SWAP_IN_USE);
+    block_write_multiple (swap_block, used_index * SECTORS_PER_PAGE,
+                          SECTORS_PER_PAGE, frame);
+    swap_out_cnt++;
+}
+
+// Drops a page's reference to slot USED_INDEX, freeing the slot
+// when no page is left in it.
+void
+swap_free (size_t used_index)
+{
+    lock_acquire (&swap_lock);
+    ASSERT (used_index < swap_slot_cnt);
+    ASSERT (bitmap_test (swap_map, used_index) == SWAP_IN_USE);
+    if (--swap_slots[used_index].ref_cnt == 0) {
+        bitmap_reset (swap_map, used_index);
+        swap_used_cnt--;
+        swap_slots[used_index].thread = NULL;
+        swap_slots[used_index].page_entry = NULL;
     }
     lock_release (&swap_lock);
-    return free_index;
 }
 
+// Adds a reference to slot USED_INDEX for another page with the same
+// contents.  Each page drops its reference with swap_free().
+void
+swap_share (size_t used_index)
+{
+    lock_acquire (&swap_lock);
+    ASSERT (used_index < swap_slot_cnt);
+    ASSERT (bitmap_test (swap_map, used_index) == SWAP_IN_USE);
+    swap_slots[used_index].ref_cnt++;
+    swap_slots[used_index].thread = NULL;
+    swap_slots[used_index].page_entry = NULL;
+    lock_release (&swap_lock);
+}
+
+// Returns true if more than one page refers to slot USED_INDEX, so
+// that it must not be written.
+bool
+swap_shared (size_t used_index)
+{
+    lock_acquire (&swap_lock);
+    ASSERT (used_index < swap_slot_cnt);
+    bool shared = swap_slots[used_index].ref_cnt > 1;
+    lock_release (&swap_lock);
+    return shared;
+}
+
+// Returns the page swapped out to slot INDEX if it belongs to the
+// running thread, otherwise a null pointer.  The page may still be in
+// transit to the slot.
+struct SP_entry *
+swap_slot_page (size_t index)
+{
+    struct SP_entry *page_entry = NULL;
+    if (index >= swap_slot_cnt) {
+        return NULL;
+    }
+    lock_acquire (&swap_lock);
+    if (swap_slots[index].thread == thread_current ()) {
+        page_entry = swap_slots[index].page_entry;
+    }
+    lock_release (&swap_lock);
+    return page_entry;
+}
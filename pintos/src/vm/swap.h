@@ -6,8 +6,20 @@
 #include "threads/vaddr.h"
 #include <bitmap.h>
 
+struct thread;
+struct SP_entry;
+
+// A page's swap_index when it has no swap slot.
+#define SWAP_NONE BITMAP_ERROR
+
 void swap_init (void);
+void swap_print_stats (void);
 void swap_in (size_t used_index, void* frame);
-size_t swap_out (void *frame);
+size_t swap_alloc (struct thread *t, struct SP_entry *page_entry);
+void swap_out (size_t used_index, void *frame);
+void swap_free (size_t used_index);
+void swap_share (size_t used_index);
+bool swap_shared (size_t used_index);
+struct SP_entry *swap_slot_page (size_t index);
 
 #endif /* vm/swap.h */